@@ -0,0 +1,198 @@
+#include "BlockLog.h"
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const uint32_t BLOCK_MAGIC = 0x4c4f4742; //"BGOL"
+
+/*
+ * Plain table-driven CRC-32 (the zlib polynomial).
+ */
+struct Crc32Table {
+  uint32_t entries[256];
+
+  Crc32Table() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k)
+	c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      entries[i] = c;
+    }
+  }
+};
+
+static uint32_t crc32(const char* data, size_t len) {
+  //built once, even with engines on several threads
+  static const Crc32Table crc_table;
+  const uint32_t* table = crc_table.entries;
+  uint32_t crc = 0xffffffffu;
+  for (size_t i = 0; i < len; ++i)
+    crc = table[(crc ^ (unsigned char)data[i]) & 0xff] ^ (crc >> 8);
+  return crc ^ 0xffffffffu;
+}
+
+BlockLog::BlockLog(string log_path) : fd(-1), direct(true), path(log_path),
+				      tail(BLOCK_SIZE, BLOCK_SIZE), tail_no(0), tail_slot(0),
+				      submitted(false), last_newline(true) {
+  fd = open(path.c_str(), O_RDWR | O_CREAT | O_DIRECT, 0644);
+  if (fd < 0 && errno == EINVAL) {
+    //e.g. tmpfs; keep the block format but go through the page cache
+    direct = false;
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  }
+  if (fd < 0)
+    return;
+
+  //pick up where the last full block or the newest tail copy left off
+  string file = readWholeFile(path);
+  int slot;
+  uint32_t full = scan(file, nullptr, &slot);
+  startBlock(full);
+  if (slot >= 0) {
+    memcpy(tail.data(), &file[(size_t)slot * BLOCK_SIZE], BLOCK_SIZE);
+    tail_slot = 1 - slot;
+  }
+  uint32_t used = header(tail.data())->used;
+  if (used > 0)
+    last_newline = tail.data()[sizeof(BlockHeader) + used - 1] == '\n';
+  else if (full > 0)
+    last_newline = file[(size_t)(TAIL_SLOTS + full) * BLOCK_SIZE - 1] == '\n';
+
+  //drop whatever follows the valid prefix so it is never read back
+  //as if it came after blocks written from here on
+  off_t keep = (off_t)(TAIL_SLOTS + full) * BLOCK_SIZE;
+  if ((off_t)file.size() > keep && ftruncate(fd, keep) != 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+BlockLog::~BlockLog() {
+  if (fd >= 0)
+    close(fd);
+}
+
+void BlockLog::append(IoBackend* io, const string& entries) {
+  if (fd < 0 || entries.empty())
+    return;
+  //the copy about to be overwritten is only a fallback once the last
+  //append's writes have landed
+  if (submitted)
+    io->drain();
+
+  uint32_t first_block = tail_no;
+  size_t count = (header(tail.data())->used + entries.size()) / PAYLOAD_SIZE;
+  IoBuffer out;
+  if (count > 0)
+    out = IoBuffer(count * BLOCK_SIZE, BLOCK_SIZE);
+  size_t filled = 0;
+
+  size_t pos = 0;
+  while (pos < entries.size()) {
+    BlockHeader* h = header(tail.data());
+    if (last_newline && h->first_lsn == -1) {
+      h->first_lsn = strtoll(entries.c_str() + pos, nullptr, 10);
+      h->first_offset = h->used;
+    }
+    //copy up to the end of this record or of this block
+    const char* nl = static_cast<const char*>(memchr(entries.data() + pos, '\n', entries.size() - pos));
+    size_t line_end = nl ? nl - entries.data() + 1 : entries.size();
+    size_t chunk = min(line_end - pos, PAYLOAD_SIZE - h->used);
+    memcpy(tail.data() + sizeof(BlockHeader) + h->used, entries.data() + pos, chunk);
+    h->used += chunk;
+    pos += chunk;
+    last_newline = entries[pos - 1] == '\n';
+
+    if (h->used == PAYLOAD_SIZE) {
+      seal(tail.data());
+      memcpy(out.data() + filled * BLOCK_SIZE, tail.data(), BLOCK_SIZE);
+      ++filled;
+      startBlock(tail_no + 1);
+    }
+  }
+
+  if (filled > 0)
+    io->submitWrite(fd, std::move(out), (off_t)(TAIL_SLOTS + first_block) * BLOCK_SIZE);
+  if (header(tail.data())->used > 0) {
+    seal(tail.data());
+    IoBuffer copy(BLOCK_SIZE, BLOCK_SIZE);
+    memcpy(copy.data(), tail.data(), BLOCK_SIZE);
+    io->submitWrite(fd, std::move(copy), (off_t)tail_slot * BLOCK_SIZE);
+    tail_slot = 1 - tail_slot;
+  }
+  io->submit();
+  submitted = true;
+}
+
+string BlockLog::read() {
+  string file = readWholeFile(path);
+  string log;
+  int slot;
+  scan(file, &log, &slot);
+  return log;
+}
+
+//private
+
+/*
+ * Fills in the magic number and checksum of a block before it is written.
+ */
+void BlockLog::seal(char* block) {
+  BlockHeader* h = header(block);
+  h->magic = BLOCK_MAGIC;
+  h->checksum = 0;
+  h->checksum = crc32(block, BLOCK_SIZE);
+}
+
+bool BlockLog::valid(char* block, uint32_t block_no) {
+  BlockHeader* h = header(block);
+  if (h->magic != BLOCK_MAGIC || h->block_no != block_no || h->used > PAYLOAD_SIZE)
+    return false;
+  uint32_t sum = h->checksum;
+  h->checksum = 0;
+  bool ok = crc32(block, BLOCK_SIZE) == sum;
+  h->checksum = sum;
+  return ok;
+}
+
+void BlockLog::startBlock(uint32_t block_no) {
+  memset(tail.data(), 0, BLOCK_SIZE);
+  tail_no = block_no;
+  BlockHeader* h = header(tail.data());
+  h->block_no = block_no;
+  h->first_lsn = -1;
+}
+
+/*
+ * Counts the full blocks at the start of file and finds the newest
+ * valid tail copy of the block after them (slot is -1 if there is
+ * none). With log set, appends the text of both to it.
+ */
+uint32_t BlockLog::scan(string& file, string* log, int* slot) {
+  uint32_t blocks = file.size() / BLOCK_SIZE;
+  uint32_t full = 0;
+  for (; TAIL_SLOTS + full < blocks; ++full) {
+    char* block = &file[(size_t)(TAIL_SLOTS + full) * BLOCK_SIZE];
+    if (!valid(block, full) || header(block)->used < PAYLOAD_SIZE)
+      break;
+    if (log)
+      log->append(block + sizeof(BlockHeader), PAYLOAD_SIZE);
+  }
+
+  //copies of one block only ever grow, so the newest is the longest
+  *slot = -1;
+  for (uint32_t s = 0; s < TAIL_SLOTS && s < blocks; ++s) {
+    char* block = &file[(size_t)s * BLOCK_SIZE];
+    if (valid(block, full) &&
+	(*slot < 0 || header(block)->used > header(&file[(size_t)*slot * BLOCK_SIZE])->used))
+      *slot = s;
+  }
+  if (log && *slot >= 0)
+    log->append(&file[(size_t)*slot * BLOCK_SIZE + sizeof(BlockHeader)],
+		header(&file[(size_t)*slot * BLOCK_SIZE])->used);
+  return full;
+}
@@ -0,0 +1,84 @@
+#ifndef BLOCKLOG_H_
+#define BLOCKLOG_H_
+
+#include <string>
+#include <stdint.h>
+#include "IoBackend.h"
+
+/*
+ * The log stored as fixed 4 KiB blocks instead of a plain text file.
+ * Each block starts with a BlockHeader followed by up to
+ * PAYLOAD_SIZE bytes of the text log; a record may span blocks.
+ * Blocks are written from aligned buffers with O_DIRECT when the
+ * file system allows it, bypassing the page cache.
+ *
+ * The last block is usually only partly full. It is kept in memory,
+ * and every time it grows it is written whole to one of the two tail
+ * slots at the front of the file, alternating between them, so the
+ * previous copy is never overwritten until the next one has landed.
+ * A block goes to its own place after the slots only once it is
+ * full. A torn write fails its checksum; read() then falls back to
+ * the newest valid tail copy.
+ */
+class BlockLog {
+ public:
+  static const size_t BLOCK_SIZE = 4096;
+
+  struct BlockHeader {
+    uint32_t magic;
+    uint32_t checksum;      //crc32 of the block with this field zeroed
+    uint32_t block_no;
+    uint32_t used;          //payload bytes in use
+    uint32_t first_offset;  //payload offset of the first record starting here
+    uint32_t reserved;
+    int64_t first_lsn;      //LSN of that record, or -1 if none starts here
+  };
+
+  static const size_t PAYLOAD_SIZE = BLOCK_SIZE - sizeof(BlockHeader);
+  //the tail slots come first; block n is stored at TAIL_SLOTS + n
+  static const uint32_t TAIL_SLOTS = 2;
+
+  /*
+   * Opens (or creates) the block log at path and loads its last
+   * partial block from the newest valid tail copy. Blocks past the
+   * valid prefix, e.g. from a torn write, are cut off.
+   */
+  BlockLog(std::string path);
+  ~BlockLog();
+
+  bool isOpen() {return fd >= 0;}
+  bool usesDirectIo() {return direct;}
+
+  /*
+   * Appends text log records through io. Full blocks and the new
+   * partial block are submitted but not waited for.
+   */
+  void append(IoBackend* io, const std::string& entries);
+
+  /*
+   * Returns the text log held in every valid block, in order.
+   */
+  std::string read();
+
+ private:
+  int fd;
+  bool direct;
+  std::string path;
+  //the block being filled, and its index in the file
+  IoBuffer tail;
+  uint32_t tail_no;
+  //the tail slot the next copy of the tail block goes to
+  uint32_t tail_slot;
+  //true while the last append's writes may be in flight
+  bool submitted;
+  //whether the last byte appended ended a record
+  bool last_newline;
+
+  BlockHeader* header(char* block) {return reinterpret_cast<BlockHeader*>(block);}
+  void seal(char* block);
+  bool valid(char* block, uint32_t block_no);
+  void startBlock(uint32_t block_no);
+  uint32_t scan(std::string& file, std::string* log, int* slot);
+};
+
+#endif
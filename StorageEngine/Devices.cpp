@@ -0,0 +1,126 @@
+#include "Devices.h"
+#include "BlockLog.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const size_t CACHE_LINE = 64;
+static const size_t DIRECT_BLOCK = 4096;
+
+static size_t roundUp(size_t bytes, size_t unit) {
+  return (bytes + unit - 1) / unit * unit;
+}
+
+FileLogDevice::~FileLogDevice() {
+  if (fd >= 0)
+    close(fd);
+}
+
+/*
+ * Opens the log file for positional appends, creating it if needed.
+ */
+void FileLogDevice::open() {
+  if (fd >= 0)
+    return;
+  fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+  if (fd >= 0)
+    size = lseek(fd, 0, SEEK_END);
+}
+
+DirectLogDevice::~DirectLogDevice() {
+  delete block_log;
+}
+
+void DirectLogDevice::open() {
+  if (!block_log)
+    block_log = new BlockLog(path);
+}
+
+void DirectLogDevice::append(IoBackend* io, const string& entries) {
+  open();
+  block_log->append(io, entries);
+}
+
+string DirectLogDevice::read(long long from) {
+  open();
+  string log = block_log->read();
+  return log.substr(min<long long>(from, log.size()));
+}
+
+template <bool Direct>
+PageFileDevice<Direct>::~PageFileDevice() {
+  if (fd >= 0)
+    close(fd);
+}
+
+/*
+ * Recreates the file with a slot per page. Slots fit the largest page
+ * rounded up to a cache line, as the buffer pool's frames do, so a
+ * page can grow as far in a slot as in a frame.
+ */
+template <bool Direct>
+void PageFileDevice<Direct>::load(vector<Page> new_pages) {
+  if (fd >= 0)
+    close(fd);
+  int flags = O_RDWR | O_CREAT | O_TRUNC;
+  fd = ::open(path.c_str(), flags | (Direct ? O_DIRECT : 0), 0644);
+  if (fd < 0 && Direct && errno == EINVAL) //e.g. tmpfs
+    fd = ::open(path.c_str(), flags, 0644);
+
+  pages = new_pages.size();
+  largest_page = 0;
+  for (unsigned i = 0; i < new_pages.size(); ++i)
+    largest_page = max(largest_page, new_pages[i].data.size());
+  capacity = roundUp(max<size_t>(largest_page, 1), CACHE_LINE);
+  slot_size = roundUp(sizeof(SlotHeader) + capacity, Direct ? DIRECT_BLOCK : CACHE_LINE);
+  slot = IoBuffer(slot_size, Direct ? DIRECT_BLOCK : CACHE_LINE);
+  for (unsigned i = 0; i < new_pages.size(); ++i)
+    write(i + 1, new_pages[i].pageLSN, new_pages[i].data);
+}
+
+template <bool Direct>
+void PageFileDevice<Direct>::read(int page_id, char* data, LSN& pageLSN, unsigned& length) {
+  pageLSN = -1;
+  length = 0;
+  if (fd < 0 || pread(fd, slot.data(), slot_size, (off_t)(page_id - 1) * slot_size) != (ssize_t)slot_size)
+    return;
+  const SlotHeader* header = reinterpret_cast<const SlotHeader*>(slot.data());
+  pageLSN = header->pageLSN;
+  length = min<size_t>(header->length, capacity);
+  memcpy(data, slot.data() + sizeof(SlotHeader), length);
+}
+
+template <bool Direct>
+void PageFileDevice<Direct>::fillSlot(char* slot_data, LSN pageLSN, string_view data) {
+  SlotHeader* header = reinterpret_cast<SlotHeader*>(slot_data);
+  header->pageLSN = pageLSN;
+  header->length = min(data.size(), capacity);
+  memcpy(slot_data + sizeof(SlotHeader), data.data(), header->length);
+  memset(slot_data + sizeof(SlotHeader) + header->length, 0,
+	 slot_size - sizeof(SlotHeader) - header->length);
+}
+
+template <bool Direct>
+bool PageFileDevice<Direct>::write(int page_id, LSN pageLSN, string_view data) {
+  if (fd < 0)
+    return false;
+  fillSlot(slot.data(), pageLSN, data);
+  return writeFully(fd, slot.data(), slot_size, (off_t)(page_id - 1) * slot_size);
+}
+
+template <bool Direct>
+bool PageFileDevice<Direct>::writeRun(vector<Page> run) {
+  if (run.empty())
+    return true;
+  IoBuffer slots(run.size() * slot_size, Direct ? DIRECT_BLOCK : CACHE_LINE);
+  if (fd < 0 || slots.size() == 0)
+    return false;
+  for (unsigned i = 0; i < run.size(); ++i)
+    fillSlot(slots.data() + i * slot_size, run[i].pageLSN, run[i].data);
+  return writeFully(fd, slots.data(), slots.size(), (off_t)(run[0].page_id - 1) * slot_size);
+}
+
+template class PageFileDevice<false>;
+template class PageFileDevice<true>;
@@ -0,0 +1,207 @@
+#ifndef DEVICES_H_
+#define DEVICES_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "IoBackend.h"
+#include "Lsn.h"
+
+class BlockLog;
+
+struct Page {
+    int page_id; //equal to the line number where it's stored in the file.
+    LSN pageLSN;
+    bool dirty;
+    std::string data;
+
+    Page() {
+        dirty = false;
+    }
+
+    Page(int new_page_id, LSN new_pageLSN, bool new_dirty, std::string new_data) {
+        page_id = new_page_id;
+        pageLSN = new_pageLSN;
+        dirty = new_dirty;
+        data = std::move(new_data);
+    }
+};
+
+/*
+ * Log devices: where a StorageEngine keeps its log. The device is a
+ * template parameter of the engine (see BasicStorageEngine), so calls
+ * to it are resolved, and usually inlined, at compile time. Every log
+ * device has
+ *
+ *   void setPath(const std::string& path)   where its file goes, if any
+ *   void append(IoBackend* io, const std::string& entries)
+ *                                           appends, through io if it
+ *                                           writes a file
+ *   std::string read(long long from)        the log from byte from on,
+ *                                           once io is drained
+ */
+
+// The log in a string; nothing touches a file. For microbenchmarks.
+class MemoryLogDevice {
+ public:
+  void setPath(const std::string&) {}
+  void append(IoBackend*, const std::string& entries) {log += entries;}
+  std::string read(long long from) {
+    return from < (long long)log.size() ? log.substr(from) : std::string();
+  }
+
+ private:
+  std::string log;
+};
+
+// A plain text file, appended at its end through the I/O backend and
+// the page cache. The file is opened by the first append.
+class FileLogDevice {
+ public:
+  FileLogDevice() : fd(-1), size(0) {}
+  ~FileLogDevice();
+  FileLogDevice(const FileLogDevice&) = delete;
+  FileLogDevice& operator=(const FileLogDevice&) = delete;
+
+  void setPath(const std::string& log_path) {path = log_path;}
+  void append(IoBackend* io, const std::string& entries) {
+    open();
+    if (fd < 0)
+      return;
+    long long offset = size;
+    size += entries.size();
+    io->submitWrite(fd, IoBuffer(entries), offset);
+    io->submit();
+  }
+  std::string read(long long from) {return readWholeFile(path, from);}
+
+ private:
+  std::string path;
+  int fd;
+  long long size;
+  void open();
+};
+
+// Checksummed 4 KiB blocks written with O_DIRECT (see BlockLog).
+class DirectLogDevice {
+ public:
+  DirectLogDevice() : block_log(nullptr) {}
+  ~DirectLogDevice();
+  DirectLogDevice(const DirectLogDevice&) = delete;
+  DirectLogDevice& operator=(const DirectLogDevice&) = delete;
+
+  void setPath(const std::string& log_path) {path = log_path;}
+  void append(IoBackend* io, const std::string& entries);
+  std::string read(long long from);
+
+ private:
+  std::string path;
+  BlockLog* block_log;
+  void open();
+};
+
+/*
+ * Page devices: where pages live while they are not in the buffer
+ * pool. Like log devices they are template parameters of the engine.
+ * Every page device has
+ *
+ *   void setPath(const std::string& path)   where its file goes, if any
+ *   void load(std::vector<Page> pages)      replaces every page
+ *   int count()                             number of pages
+ *   size_t largest()                        bytes in the largest page
+ *   void read(int page_id, char* data, LSN& pageLSN, unsigned& length)
+ *                                           copies a page into data
+ *   bool write(int page_id, LSN pageLSN, std::string_view data)
+ *   bool writeRun(std::vector<Page> run)    writes pages with consecutive
+ *                                           ids, in id order, in one I/O
+ *                                           where the device can
+ * The writes return false if the pages may not all have reached the
+ * device.
+ */
+
+// The pages in memory, as the engine always kept them: they only reach
+// a file when the engine writes the database out.
+class MemoryPageDevice {
+ public:
+  void setPath(const std::string&) {}
+  void load(std::vector<Page> new_pages) {pages = std::move(new_pages);}
+  int count() {return pages.size();}
+  size_t largest() {
+    size_t bytes = 0;
+    for (unsigned i = 0; i < pages.size(); ++i)
+      bytes = std::max(bytes, pages[i].data.size());
+    return bytes;
+  }
+  void read(int page_id, char* data, LSN& pageLSN, unsigned& length) {
+    const Page& page = pages[page_id - 1];
+    memcpy(data, page.data.data(), page.data.size());
+    pageLSN = page.pageLSN;
+    length = page.data.size();
+  }
+  bool write(int page_id, LSN pageLSN, std::string_view data) {
+    Page& page = pages[page_id - 1];
+    page.pageLSN = pageLSN;
+    page.data.assign(data.data(), data.size());
+    return true;
+  }
+  bool writeRun(std::vector<Page> run) {
+    for (unsigned i = 0; i < run.size(); ++i) {
+      Page& page = pages[run[i].page_id - 1];
+      page.pageLSN = run[i].pageLSN;
+      page.data = std::move(run[i].data);
+    }
+    return true;
+  }
+
+ private:
+  std::vector<Page> pages;
+};
+
+/*
+ * The pages in fixed-size slots of a file, page_id - 1 being the slot
+ * number: a SlotHeader, then the page's bytes. Each read and write is
+ * one pread or pwrite of a slot, and a run of pages one pwrite of its
+ * adjacent slots. With Direct the file is opened with
+ * O_DIRECT (if the file system allows it) and slots are whole 4 KiB
+ * blocks moved through an aligned buffer.
+ */
+template <bool Direct>
+class PageFileDevice {
+ public:
+  PageFileDevice() : fd(-1), pages(0), slot_size(0), capacity(0), largest_page(0) {}
+  ~PageFileDevice();
+  PageFileDevice(const PageFileDevice&) = delete;
+  PageFileDevice& operator=(const PageFileDevice&) = delete;
+
+  void setPath(const std::string& file_path) {path = file_path;}
+  void load(std::vector<Page> new_pages);
+  int count() {return pages;}
+  size_t largest() {return largest_page;}
+  void read(int page_id, char* data, LSN& pageLSN, unsigned& length);
+  bool write(int page_id, LSN pageLSN, std::string_view data);
+  bool writeRun(std::vector<Page> run);
+
+ private:
+  struct SlotHeader {
+    int64_t pageLSN;
+    uint32_t length;
+  };
+  void fillSlot(char* slot_data, LSN pageLSN, std::string_view data);
+
+  std::string path;
+  int fd;
+  int pages;
+  size_t slot_size;
+  size_t capacity;      //page bytes a slot holds
+  size_t largest_page;
+  IoBuffer slot;
+};
+
+typedef PageFileDevice<false> FilePageDevice;
+typedef PageFileDevice<true> DirectPageDevice;
+
+#endif
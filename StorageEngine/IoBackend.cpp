@@ -0,0 +1,438 @@
+#include "IoBackend.h"
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <map>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+using namespace std;
+
+///////////////////  IoBuffer  ///////////////////
+
+IoBuffer::IoBuffer(size_t size, size_t alignment) : buf(nullptr), len(size) {
+  void* p = nullptr;
+  if (posix_memalign(&p, alignment, size == 0 ? alignment : size) != 0)
+    p = nullptr;
+  buf = static_cast<char*>(p);
+  if (buf)
+    memset(buf, 0, size);
+  else
+    len = 0;
+}
+
+IoBuffer::IoBuffer(const string& contents) : IoBuffer(contents.size(), sizeof(void*)) {
+  if (buf)
+    memcpy(buf, contents.data(), len);
+}
+
+IoBuffer::IoBuffer(IoBuffer&& other) : buf(other.buf), len(other.len) {
+  other.buf = nullptr;
+  other.len = 0;
+}
+
+IoBuffer& IoBuffer::operator=(IoBuffer&& other) {
+  if (this != &other) {
+    free(buf);
+    buf = other.buf;
+    len = other.len;
+    other.buf = nullptr;
+    other.len = 0;
+  }
+  return *this;
+}
+
+IoBuffer::~IoBuffer() {
+  free(buf);
+}
+
+bool writeFully(int fd, const char* buf, size_t len, off_t offset) {
+  while (len > 0) {
+    ssize_t n = pwrite(fd, buf, len, offset);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    buf += n;
+    len -= n;
+    offset += n;
+  }
+  return true;
+}
+
+string readWholeFile(string path, off_t from) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return "";
+  struct stat st;
+  string contents;
+  if (fstat(fd, &st) == 0 && st.st_size > from) {
+    contents.resize(st.st_size - from);
+    size_t done = 0;
+    while (done < contents.size()) {
+      ssize_t n = pread(fd, &contents[done], contents.size() - done, from + done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      done += n;
+    }
+    contents.resize(done);
+  }
+  close(fd);
+  return contents;
+}
+
+///////////////////  SyncIoBackend  ///////////////////
+
+/*
+ * Writes each request as soon as it is queued.
+ */
+class SyncIoBackend : public IoBackend {
+ public:
+  SyncIoBackend() : failed(false) {}
+
+  virtual void submitWrite(int fd, IoBuffer buf, off_t offset) {
+    if (!writeFully(fd, buf.data(), buf.size(), offset))
+      failed = true;
+  }
+  virtual void submit() {}
+  virtual bool drain() {
+    bool ok = !failed;
+    failed = false;
+    return ok;
+  }
+  virtual unsigned inFlight() {return 0;}
+
+ private:
+  bool failed;
+};
+
+///////////////////  ThreadPoolIoBackend  ///////////////////
+
+/*
+ * A fixed pool of threads that pwrite submitted requests.
+ * Writes that are in flight together must not overlap, since
+ * the threads may finish them in any order.
+ */
+class ThreadPoolIoBackend : public IoBackend {
+ public:
+  ThreadPoolIoBackend(unsigned queue_depth, unsigned threads) :
+    depth(queue_depth == 0 ? 1 : queue_depth), active(0), failed(false), stopping(false) {
+    for (unsigned i = 0; i < threads; ++i)
+      workers.push_back(thread(&ThreadPoolIoBackend::work, this));
+  }
+
+  virtual ~ThreadPoolIoBackend() {
+    drain();
+    {
+      lock_guard<mutex> lock(mtx);
+      stopping = true;
+    }
+    work_ready.notify_all();
+    for (unsigned i = 0; i < workers.size(); ++i)
+      workers[i].join();
+  }
+
+  virtual void submitWrite(int fd, IoBuffer buf, off_t offset) {
+    //inFlight() counts the staged writes too
+    if (inFlight() >= depth)
+      submit();
+    unique_lock<mutex> lock(mtx);
+    work_done.wait(lock, [this]{ return staged.size() + queued.size() + active < depth; });
+    staged.push_back(Request(fd, std::move(buf), offset));
+  }
+
+  virtual void submit() {
+    if (staged.empty())
+      return;
+    {
+      lock_guard<mutex> lock(mtx);
+      for (unsigned i = 0; i < staged.size(); ++i)
+        queued.push_back(std::move(staged[i]));
+    }
+    staged.clear();
+    work_ready.notify_all();
+  }
+
+  virtual bool drain() {
+    submit();
+    unique_lock<mutex> lock(mtx);
+    work_done.wait(lock, [this]{ return queued.empty() && active == 0; });
+    bool ok = !failed;
+    failed = false;
+    return ok;
+  }
+
+  virtual unsigned inFlight() {
+    lock_guard<mutex> lock(mtx);
+    return staged.size() + queued.size() + active;
+  }
+
+ private:
+  struct Request {
+    int fd;
+    IoBuffer buf;
+    off_t offset;
+    Request(int f, IoBuffer b, off_t off) : fd(f), buf(std::move(b)), offset(off) {}
+  };
+
+  unsigned depth;
+  //queued by submitWrite, not yet handed to the workers
+  vector<Request> staged;
+  deque<Request> queued;
+  unsigned active;
+  bool failed;
+  bool stopping;
+  mutex mtx;
+  condition_variable work_ready;
+  condition_variable work_done;
+  vector<thread> workers;
+
+  void work() {
+    unique_lock<mutex> lock(mtx);
+    while (true) {
+      work_ready.wait(lock, [this]{ return stopping || !queued.empty(); });
+      if (queued.empty())
+        return;
+      Request req = std::move(queued.front());
+      queued.pop_front();
+      ++active;
+      lock.unlock();
+      bool ok = writeFully(req.fd, req.buf.data(), req.buf.size(), req.offset);
+      lock.lock();
+      --active;
+      if (!ok)
+        failed = true;
+      work_done.notify_all();
+    }
+  }
+};
+
+///////////////////  UringIoBackend  ///////////////////
+
+/*
+ * io_uring through the raw system calls. Each write becomes one
+ * IORING_OP_WRITE entry; submit rings the doorbell once for everything
+ * queued, and completions are reaped in batches. Like the thread pool,
+ * writes in flight together must not overlap.
+ */
+class UringIoBackend : public IoBackend {
+ public:
+  UringIoBackend(unsigned queue_depth) :
+    ring_fd(-1), sq_ptr(MAP_FAILED), cq_ptr(MAP_FAILED), sqes(nullptr),
+    next_id(1), to_submit(0), failed(false) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring_fd = (int)syscall(__NR_io_uring_setup, queue_depth == 0 ? 1 : queue_depth, &p);
+    if (ring_fd < 0)
+      return;
+    depth = p.sq_entries;
+
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap)
+      sq_len = cq_len = max(sq_len, cq_len);
+
+    sq_ptr = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		  ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED)
+      { teardown(); return; }
+    cq_ptr = single_mmap ? sq_ptr :
+      mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	   ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED)
+      { teardown(); return; }
+    sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    void* s = mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		   ring_fd, IORING_OFF_SQES);
+    if (s == MAP_FAILED)
+      { teardown(); return; }
+    sqes = static_cast<struct io_uring_sqe*>(s);
+
+    char* sq = static_cast<char*>(sq_ptr);
+    sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    char* cq = static_cast<char*>(cq_ptr);
+    cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+  }
+
+  virtual ~UringIoBackend() {
+    if (ok())
+      drain();
+    teardown();
+  }
+
+  bool ok() {return sqes != nullptr;}
+
+  virtual void submitWrite(int fd, IoBuffer buf, off_t offset) {
+    if (!ok()) {
+      if (!writeFully(fd, buf.data(), buf.size(), offset))
+	failed = true;
+      return;
+    }
+    while (inflight.size() >= depth)
+      reap(1);
+    unsigned long long id = next_id++;
+    Request& req = inflight[id];
+    req.fd = fd;
+    req.buf = std::move(buf);
+    req.offset = offset;
+
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<unsigned long long>(req.buf.data());
+    sqe->len = req.buf.size();
+    sqe->off = offset;
+    sqe->user_data = id;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++to_submit;
+  }
+
+  virtual void submit() {
+    if (ok())
+      enter(0);
+  }
+
+  virtual bool drain() {
+    while (!inflight.empty())
+      reap(inflight.size());
+    bool result = !failed;
+    failed = false;
+    return result;
+  }
+
+  virtual unsigned inFlight() {return inflight.size();}
+
+ private:
+  struct Request {
+    int fd;
+    IoBuffer buf;
+    off_t offset;
+  };
+
+  int ring_fd;
+  unsigned depth;
+  void* sq_ptr;
+  void* cq_ptr;
+  size_t sq_len, cq_len, sqes_len;
+  unsigned *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe* sqes;
+  struct io_uring_cqe* cqes;
+  map<unsigned long long, Request> inflight;
+  unsigned long long next_id;
+  unsigned to_submit;
+  bool failed;
+
+  void teardown() {
+    if (sqes)
+      munmap(sqes, sqes_len);
+    if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+      munmap(cq_ptr, cq_len);
+    if (sq_ptr != MAP_FAILED)
+      munmap(sq_ptr, sq_len);
+    if (ring_fd >= 0)
+      close(ring_fd);
+    sqes = nullptr;
+    sq_ptr = cq_ptr = MAP_FAILED;
+    ring_fd = -1;
+  }
+
+  /*
+   * Submits whatever is queued and waits for min_complete completions.
+   */
+  void enter(unsigned min_complete) {
+    while (to_submit > 0 || min_complete > 0) {
+      unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+      int ret = (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags,
+			     nullptr, 0);
+      if (ret < 0) {
+	if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+	  continue;
+	//the ring is unusable; finish everything by hand and
+	//write synchronously from now on
+	fallbackAll();
+	teardown();
+	return;
+      }
+      to_submit -= min((unsigned)ret, to_submit);
+      if (to_submit == 0)
+	return;
+    }
+  }
+
+  void reap(unsigned min_complete) {
+    enter(min_complete);
+    if (!ok())
+      return;
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      struct io_uring_cqe* cqe = &cqes[head & *cq_mask];
+      complete(cqe->user_data, cqe->res);
+      ++head;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  void complete(unsigned long long id, int res) {
+    map<unsigned long long, Request>::iterator it = inflight.find(id);
+    if (it == inflight.end())
+      return;
+    Request& req = it->second;
+    if (res < 0) {
+      //e.g. a kernel without IORING_OP_WRITE; retry with pwrite
+      if (!writeFully(req.fd, req.buf.data(), req.buf.size(), req.offset))
+	failed = true;
+    } else if ((size_t)res < req.buf.size()) {
+      //short write: finish the rest synchronously
+      if (!writeFully(req.fd, req.buf.data() + res, req.buf.size() - res, req.offset + res))
+	failed = true;
+    }
+    inflight.erase(it);
+  }
+
+  void fallbackAll() {
+    for (map<unsigned long long, Request>::iterator it = inflight.begin(); it != inflight.end(); ++it)
+      if (!writeFully(it->second.fd, it->second.buf.data(), it->second.buf.size(), it->second.offset))
+	failed = true;
+    inflight.clear();
+    to_submit = 0;
+  }
+};
+
+///////////////////  IoBackend::create  ///////////////////
+
+IoBackend* IoBackend::create(string name, unsigned queue_depth) {
+  if (name == "uring") {
+    UringIoBackend* uring = new UringIoBackend(queue_depth);
+    if (uring->ok())
+      return uring;
+    delete uring;
+    name = "threads";
+  }
+  if (name == "threads")
+    return new ThreadPoolIoBackend(queue_depth, min(queue_depth == 0 ? 1u : queue_depth, 4u));
+  return new SyncIoBackend();
+}
@@ -0,0 +1,84 @@
+#ifndef IOBACKEND_H_
+#define IOBACKEND_H_
+
+#include <string>
+#include <cstddef>
+#include <sys/types.h>
+
+/*
+ * A heap buffer handed to an IoBackend for one write. The backend owns
+ * it until the write completes, so callers never have to keep the
+ * bytes alive themselves. Allocated with the requested alignment, which
+ * lets the same buffers be used for O_DIRECT.
+ */
+class IoBuffer {
+ public:
+  IoBuffer() : buf(nullptr), len(0) {}
+  IoBuffer(size_t size, size_t alignment);
+  explicit IoBuffer(const std::string& contents);
+  IoBuffer(IoBuffer&& other);
+  IoBuffer& operator=(IoBuffer&& other);
+  ~IoBuffer();
+
+  char* data() {return buf;}
+  size_t size() {return len;}
+
+ private:
+  char* buf;
+  size_t len;
+
+  IoBuffer(const IoBuffer&);
+  IoBuffer& operator=(const IoBuffer&);
+};
+
+/*
+ * Where StorageEngine sends its file writes. Writes are queued with
+ * submitWrite, pushed to the device with submit, and completed in a
+ * batch by drain, so several writes can be in flight at once.
+ */
+class IoBackend {
+ public:
+  virtual ~IoBackend() {}
+
+  /*
+   * Queues a write of buf at offset of fd. At most queue_depth writes
+   * are in flight; past that, this waits for earlier ones to finish.
+   */
+  virtual void submitWrite(int fd, IoBuffer buf, off_t offset) = 0;
+
+  /*
+   * Hands every queued write to the device without waiting for it.
+   */
+  virtual void submit() = 0;
+
+  /*
+   * Waits until every write submitted so far has completed.
+   * Returns false if any of them failed.
+   */
+  virtual bool drain() = 0;
+
+  /*
+   * Number of writes submitted but not yet known to be complete.
+   */
+  virtual unsigned inFlight() = 0;
+
+  /*
+   * Makes a backend by name: "sync", "threads" or "uring".
+   * Falls back to "threads" if io_uring is unavailable, and to "sync"
+   * for unknown names.
+   */
+  static IoBackend* create(std::string name, unsigned queue_depth);
+};
+
+/*
+ * pwrite until every byte is written. Returns false on error.
+ */
+bool writeFully(int fd, const char* buf, size_t len, off_t offset);
+
+/*
+ * Reads the file at path, from byte from to its end, into a string
+ * with pread. Returns an empty string if the file cannot be opened.
+ */
+std::string readWholeFile(std::string path, off_t from = 0);
+
+#endif
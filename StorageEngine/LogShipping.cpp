@@ -0,0 +1,64 @@
+#include "LogShipping.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+string FileLogSource::read() {
+  string bytes;
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return bytes;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > offset) {
+    bytes.resize(st.st_size - offset);
+    ssize_t got = pread(fd, &bytes[0], bytes.size(), offset);
+    bytes.resize(got > 0 ? got : 0);
+    offset += bytes.size();
+  }
+  close(fd);
+  return bytes;
+}
+
+FdLogSource::FdLogSource(int read_fd) : fd(read_fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+FdLogSource::~FdLogSource() {
+  if (fd >= 0)
+    close(fd);
+}
+
+string FdLogSource::read() {
+  string bytes;
+  char buf[65536];
+  while (true) {
+    ssize_t got = ::read(fd, buf, sizeof(buf));
+    if (got > 0)
+      bytes.append(buf, got);
+    else if (got < 0 && errno == EINTR)
+      continue;
+    else
+      break; //EAGAIN: nothing more for now; 0: the primary is gone
+  }
+  return bytes;
+}
+
+bool openLogChannel(string kind, int& write_fd, int& read_fd) {
+  int fds[2];
+  if (kind == "pipe") {
+    if (pipe2(fds, O_CLOEXEC) != 0)
+      return false;
+  } else if (kind == "socket") {
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+      return false;
+  } else {
+    return false;
+  }
+  read_fd = fds[0];
+  write_fd = fds[1];
+  return true;
+}
@@ -0,0 +1,59 @@
+#ifndef LOGSHIPPING_H_
+#define LOGSHIPPING_H_
+
+#include <string>
+#include <sys/types.h>
+
+/*
+ * Where a standby reads the primary's log from. The bytes are the
+ * text log, exactly as the primary made it durable, so a read may end
+ * in the middle of a record.
+ */
+class LogSource {
+ public:
+  virtual ~LogSource() {}
+
+  /*
+   * Returns every log byte that arrived since the last call, or an
+   * empty string if none did. Never waits.
+   */
+  virtual std::string read() = 0;
+};
+
+/*
+ * Follows the primary's log file in a shared directory by reading
+ * from where the last read stopped to the current end of the file.
+ * Only works with the text log format.
+ */
+class FileLogSource : public LogSource {
+ public:
+  FileLogSource(std::string log_path) : path(log_path), offset(0) {}
+  std::string read();
+
+ private:
+  std::string path;
+  off_t offset;
+};
+
+/*
+ * Reads the log from the receiving end of a pipe or a Unix socket
+ * that the primary ships its log into. Owns and closes fd.
+ */
+class FdLogSource : public LogSource {
+ public:
+  FdLogSource(int read_fd);
+  ~FdLogSource();
+  std::string read();
+
+ private:
+  int fd;
+};
+
+/*
+ * Opens a channel to ship the log over: "pipe" makes a pipe and
+ * "socket" a connected pair of Unix stream sockets. Returns false for
+ * other kinds or if the channel cannot be made.
+ */
+bool openLogChannel(std::string kind, int& write_fd, int& read_fd);
+
+#endif
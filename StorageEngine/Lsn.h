@@ -0,0 +1,14 @@
+#ifndef LSN_H_
+#define LSN_H_
+
+#include <cstdint>
+
+/*
+ * A log sequence number: the byte offset of a log record in the log,
+ * counted from the first byte the log ever had. A record can be read
+ * straight from its LSN, and the LSNs of two records say how much log
+ * lies between them. -1 is the null LSN.
+ */
+typedef int64_t LSN;
+
+#endif
@@ -1,13 +1,92 @@
 #include "StorageEngine.h"
 #include "../StudentComponent/LogMgr.h"
+#include "IoBackend.h"
+#include "../StudentComponent/LockMgr.h"
+#include <climits>
 #include <cstring>
 #include <string>
 #include <fstream>
+#include <map>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 using namespace std;
 
-StorageEngine::StorageEngine() : MEMORY_SIZE(10) {
+static const size_t CACHE_LINE = 64;
+
+template <class LogDevice, class PageDevice>
+BasicStorageEngine<LogDevice, PageDevice>::BasicStorageEngine() : MEMORY_SIZE(10) {
+    frames = NULL;
+    lm_ptr = NULL;
+    frame_size = 0;
     page_writes_permitted = 0;
+    io_backend_name = "sync";
+    io_queue_depth = 8;
+    io = IoBackend::create(io_backend_name, io_queue_depth);
+    ship_fd = -1;
+    log_time_index = false;
+    repairing = false;
+    lock_mgr = new LockMgr();
+    lock_mgr->setVictimHandler([this](int txid) {abortVictim(txid);});
+    locking = false;
+    cleaner_pages = 0;
+    output_dir = "output";
+}
+
+template <class LogDevice, class PageDevice>
+BasicStorageEngine<LogDevice, PageDevice>::~BasicStorageEngine() {
+    io->drain();
+    delete io;
+    delete lock_mgr;
+    free(frames);
+}
+
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::setIoBackend(string name) {
+    io->drain();
+    delete io;
+    io_backend_name = name;
+    io = IoBackend::create(io_backend_name, io_queue_depth);
+}
+
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::setOutputDir(string dir) {
+    output_dir = dir;
+}
+
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::setLocking(bool on) {
+    locking = on;
+}
+
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::setPageCleaner(unsigned pages) {
+    cleaner_pages = pages;
+}
+
+/*
+ * A deadlock victim or a waiter that timed out is rolled back in full;
+ * page_writes_permitted is the crash simulation's budget, not its.
+ */
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::abortVictim(int txid) {
+    lock_guard<recursive_mutex> guard(latch);
+    int saved = page_writes_permitted;
+    abort(txid, INT_MAX);
+    page_writes_permitted = saved;
+}
+
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::setIoQueueDepth(unsigned queue_depth) {
+    io->drain();
+    delete io;
+    io_queue_depth = queue_depth;
+    io = IoBackend::create(io_backend_name, io_queue_depth);
 }
 
 /* 
@@ -15,20 +94,24 @@ StorageEngine::StorageEngine() : MEMORY_SIZE(10) {
  * Starts the storage engine with a database by reading the database from a file
  * Also sets the associated LogMgr and the logfile name.
  */
-void StorageEngine::start(string db_filename, LogMgr* log_mgr_ptr, string testcase_num) {
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::start(string db_filename, LogMgrType* log_mgr_ptr, string testcase_num) {
 
   lm_ptr = log_mgr_ptr;
-  log_filename = "output/log/log";
+  log_filename = output_dir + "/log/log";
   log_filename.append(testcase_num);
   log_filename.append(".log");
 
-  output_filename = "output/dbs/db";
+  output_filename = output_dir + "/dbs/db";
   output_filename.append(testcase_num);
   output_filename.append(".db");
+  log_device.setPath(log_filename);
+  page_device.setPath(output_filename + ".pages");
 
   ifstream dbf(db_filename);
+  vector<Page> pages;
   int page_id = 1;
-  int pageLSN = 0;
+  LSN pageLSN = 0;
   string data = "";
   while(true) {
     if(!(dbf >> pageLSN))
@@ -38,43 +121,63 @@ void StorageEngine::start(string db_filename, LogMgr* log_mgr_ptr, string testca
       break;
 
     Page p = Page(page_id, pageLSN, false, data);
-    onDisk.push_back(p);
+    pages.push_back(p);
 
     ++page_id;
   }
 
   dbf.close();
+  page_device.load(move(pages));
+  allocateFrames();
 }
 
-void StorageEngine::end(string db_filename) {
-  //For each page in onDisk, 
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::end(string db_filename) {
+  //recovery still running in the background finishes first
+  lm_ptr->finishRecovery();
+  //For each page on the page device,
     //write the page to db_filename 
-  ofstream dbf(db_filename);
-  for(unsigned i = 0; i < onDisk.size(); ++i) {
-    dbf << onDisk[i].pageLSN << ' ' << onDisk[i].data << endl;
-  }
-  dbf.close();
+  int fd = open(db_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return;
+  writePages(fd, 0);
+  io->drain();
+  close(fd);
 }
 
 /* 
- * crash(int safe_writes, LogMgr* log_mgr_ptr)
+ * crash(int safe_writes, LogMgrType* log_mgr_ptr)
  * Sets page_writes_permitted to safe_writes. This is how many writes will
  * be allowed before the next crash occurs.
  * Replaces the old lm_ptr with log_mgr_ptr.
- * Empties the records vector (our page buffer).
+ * Empties the buffer pool.
  * Reads the log from log_entries
  * Calls lm_ptr ->recover()
  * 
  */
-void StorageEngine::crash(int safe_writes, LogMgr* log_mgr_ptr) {
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::crash(int safe_writes, LogMgrType* log_mgr_ptr) {
+  //the old LogMgr may outlive the engine, so its log writer thread
+  //has to be gone before the latch is taken
+  if (lm_ptr)
+    lm_ptr->stopLogWriter();
+  lock_guard<recursive_mutex> guard(latch);
+  //log appends already handed to the device are treated as having
+  //reached it before the crash
+  syncLog();
   page_writes_permitted = safe_writes;
   lm_ptr = log_mgr_ptr;
-  records.clear();
+  clearFrames();
+  lock_mgr->clear();
   string log = getLog();
+  //the tail the LogMgr lost never reached the log, so its LSNs are
+  //handed out again
+  log_end = log_start + log.size();
   lm_ptr->recover(log);
 }
 
-void StorageEngine::end_crash(LogMgr* log_mgr_ptr) {
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::end_crash(LogMgrType* log_mgr_ptr) {
   lm_ptr = log_mgr_ptr;
   page_writes_permitted = 0;
 }
@@ -86,23 +189,186 @@ void StorageEngine::end_crash(LogMgr* log_mgr_ptr) {
  * We will append the log entries to the end of our log file.
  *
  */
-void StorageEngine::updateLog(string log_entries) {
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::updateLog(string log_entries) {
 //find the file called [log_filename]. If it doesn't exist, create it.
 //Append the string log_entries to the end of it.
-//Close it.
-    ofstream myfile;
-    myfile.open(log_filename, std::ios_base::app);
-    if (!myfile.is_open()){
-        std::ofstream outfile (log_filename);
-        outfile << log_entries;
-        outfile.close();
+    updateLogAsync(log_entries);
+    syncLog();
+}
+
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::updateLogAsync(string log_entries) {
+    if (log_entries.empty())
+      return;
+    if (ship_fd >= 0)
+      ship_backlog += log_entries;
+    if (log_time_index)
+      indexLogTime(log_entries);
+    log_device.append(io, log_entries);
+}
+
+template <class LogDevice, class PageDevice>
+bool BasicStorageEngine<LogDevice, PageDevice>::syncLog() {
+    //only ship what the primary itself could recover
+    bool ok = io->drain();
+    shipLog();
+    return ok;
+}
+
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::setLogShipFd(int fd) {
+    ship_fd = -1;
+    ship_backlog.clear();
+    if (fd < 0)
+      return;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    ship_backlog = getLog();
+    ship_fd = fd;
+    shipLog();
+}
+
+template <class LogDevice, class PageDevice>
+string BasicStorageEngine<LogDevice, PageDevice>::getLogFileName() {
+    return log_filename;
+}
+
+template <class LogDevice, class PageDevice>
+string BasicStorageEngine<LogDevice, PageDevice>::getLogFrom(LSN from) {
+    syncLog();
+    return log_device.read(from - log_start);
+}
+
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::setLogTimeIndex(bool on) {
+    log_time_index = on;
+}
+
+template <class LogDevice, class PageDevice>
+LSN BasicStorageEngine<LogDevice, PageDevice>::lsnAtTime(long long time_ms) {
+    ifstream index(log_filename + ".times");
+    LSN lsn, found = -1;
+    long long when;
+    while (index >> lsn >> when && when <= time_ms)
+      found = lsn;
+    return found;
+}
+
+/*
+ * backup(path, info)
+ *
+ * A header line ("backup", then info's fields, tab separated) followed
+ * by the pages in the same format end() writes.
+ */
+template <class LogDevice, class PageDevice>
+bool BasicStorageEngine<LogDevice, PageDevice>::backup(string path, BackupInfo info) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      return false;
+    string header = "backup\t" + to_string(info.checkpoint_lsn) + "\t" + to_string(info.redo_lsn) +
+      "\t" + to_string(info.log_offset) + "\t" + to_string(info.time_ms) + "\n";
+    io->submitWrite(fd, IoBuffer(header), 0);
+    writePages(fd, header.size());
+    bool ok = io->drain();
+    close(fd);
+    return ok;
+}
+
+template <class LogDevice, class PageDevice>
+bool BasicStorageEngine<LogDevice, PageDevice>::loadBackup(string path, BackupInfo& info) {
+    ifstream in(path);
+    string magic;
+    if (!(in >> magic >> info.checkpoint_lsn >> info.redo_lsn >> info.log_offset >> info.time_ms) ||
+        magic != "backup")
+      return false;
+    in.get();
+    vector<Page> pages;
+    LSN pageLSN;
+    string data;
+    while (in >> pageLSN) {
+      in.get();
+      if (!getline(in, data))
+        break;
+      pages.push_back(Page(pages.size() + 1, pageLSN, false, data));
     }
-    else{
-        myfile << log_entries;
+    page_device.load(move(pages));
+    allocateFrames();
+    return true;
+}
+
+template <class LogDevice, class PageDevice>
+bool BasicStorageEngine<LogDevice, PageDevice>::flushAll() {
+    writeBackAll();
+    for (int i = (int)frame_order.size() - 1; i >= 0; --i)
+      if (!frame_desc[frame_order[i]].dirty)
+	flushPage(frame_desc[frame_order[i]].page_id);
+    return frame_order.empty();
+}
+
+template <class LogDevice, class PageDevice>
+int BasicStorageEngine<LogDevice, PageDevice>::writeBack(vector<int> page_ids) {
+    vector<int> batch;
+    for (unsigned i = 0; i < frame_order.size(); ++i)
+      if (find(page_ids.begin(), page_ids.end(), frame_desc[frame_order[i]].page_id) != page_ids.end())
+        batch.push_back(frame_order[i]);
+    return writeBackFrames(batch);
+}
+
+template <class LogDevice, class PageDevice>
+int BasicStorageEngine<LogDevice, PageDevice>::writeBackAll() {
+    return writeBackFrames(frame_order);
+}
+
+/*
+ * prefetch (page_ids)
+ *
+ * Pages of the window that are already buffered, and those in keep,
+ * stay pinned with the new ones while the window loads, so loading
+ * cannot evict them.
+ * Each load is a synchronous read from the page device; sorting keeps
+ * the reads in disk order.
+ */
+template <class LogDevice, class PageDevice>
+int BasicStorageEngine<LogDevice, PageDevice>::prefetch(vector<int> page_ids, const vector<int>& keep) {
+    vector<int> pinned;
+    for (unsigned i = 0; i < frame_order.size(); ++i)
+      if (find(keep.begin(), keep.end(), frame_desc[frame_order[i]].page_id) != keep.end())
+        pinned.push_back(frame_order[i]);
+
+    //the window gets the frames keep leaves
+    vector<int> window;
+    for (unsigned i = 0; i < page_ids.size() && window.size() + pinned.size() < MEMORY_SIZE; ++i)
+      if (page_ids[i] >= 1 && page_ids[i] <= page_device.count() &&
+          find(window.begin(), window.end(), page_ids[i]) == window.end() &&
+          find(keep.begin(), keep.end(), page_ids[i]) == keep.end())
+        window.push_back(page_ids[i]);
+    sort(window.begin(), window.end());
+
+    for (unsigned i = 0; i < frame_order.size(); ++i)
+      if (find(window.begin(), window.end(), frame_desc[frame_order[i]].page_id) != window.end())
+        pinned.push_back(frame_order[i]);
+    for (unsigned i = 0; i < pinned.size(); ++i)
+      ++frame_desc[pinned[i]].pin_count;
+
+    int loaded = 0;
+    for (unsigned w = 0; w < window.size(); ++w) {
+      bool buffered = false;
+      for (unsigned i = 0; i < pinned.size(); ++i)
+        buffered = buffered || frame_desc[pinned[i]].page_id == window[w];
+      if (buffered)
+        continue;
+      int frame = loadPage(window[w]);
+      if (frame < 0)
+        break;
+      frame_desc[frame].prefetched = true;
+      ++frame_desc[frame].pin_count;
+      pinned.push_back(frame);
+      ++loaded;
     }
-    
-    myfile.close();
-    
+    for (unsigned i = 0; i < pinned.size(); ++i)
+      --frame_desc[pinned[i]].pin_count;
+    metrics.add("prefetch_pages", loaded);
+    return loaded;
 }
 
 /* 
@@ -112,42 +378,142 @@ void StorageEngine::updateLog(string log_entries) {
  * transaction specified by txid.
  * 
  */
-void StorageEngine::write(int txid, int page_id, int offset, string input) {
-    //Use findPage() to get the page's location in records vector
+template <class LogDevice, class PageDevice>
+bool BasicStorageEngine<LogDevice, PageDevice>::write(int txid, int page_id, int offset, string_view input) {
+    //pages grow only as far as their frame
+    if (offset < 0 || offset + input.length() > frame_size)
+      return false;
+    if (locking && !lock_mgr->lock(txid, page_id, offset, input.length(), EXCLUSIVE))
+      return false;
+    lock_guard<recursive_mutex> guard(latch);
+    lm_ptr->lockPage(txid, page_id);
+    //Use findPage() to get the page's frame in the buffer pool
     int getindex = findPage(page_id);
-    //old = whatever's on the page at the offset; length of old should be same as length of input
-    string old;
-    for (unsigned i = 0; i<input.length(); ++i) {
-      old += records[getindex].data[offset+i];
-    }
-    int pageLSN = lm_ptr->write(txid, page_id, offset, input, old);
+    if (getindex < 0)
+      return false;
+    //old = whatever's on the page at the offset; length of old should be same as length of input.
+    //Past the end of the page it is the zeros updatePage fills in.
+    unsigned length = frame_desc[getindex].length;
+    string old(frameData(getindex) + min((unsigned)offset, length),
+	       min(input.length(), (size_t)(length - min((unsigned)offset, length))));
+    old.resize(input.length(), '\0');
+    //the log record takes over old rather than copying it
+    LSN pageLSN = lm_ptr->write(txid, page_id, offset, input, move(old));
     //write the updated page
     updatePage(page_id, offset, input);
     //and update the pageLSN for the page
     updateLSN(page_id, pageLSN);
+    return true;
 }
 
-void StorageEngine::abort(int txid, int pages_allowed){
-  page_writes_permitted = pages_allowed;
-  lm_ptr->abort(txid);
+/*
+ * read (txid, page_id, offset, len, data)
+ *
+ * Takes the range as it is in the buffer and lets the LogMgr roll back
+ * what txid's snapshot must not see.
+ */
+template <class LogDevice, class PageDevice>
+bool BasicStorageEngine<LogDevice, PageDevice>::read(int txid, int page_id, int offset, int len, string& data) {
+    lock_guard<recursive_mutex> guard(latch);
+    //a loser still being rolled back in the background has no versions
+    lm_ptr->lockPage(txid, page_id);
+    int getindex = findPage(page_id);
+    if (getindex < 0 || offset < 0)
+      return false;
+    len = max(0, min(len, (int)frame_desc[getindex].length - offset));
+    data.assign(frameData(getindex) + offset, len);
+    return lm_ptr->snapshotRead(txid, page_id, offset, data);
 }
 
 /*
- * nextLSN()
+ * writeBatch (txid, writes)
  *
- * Increments the log_sequence_number by 1 and returns it.
+ * Groups the writes by page (in the order pages first appear), applies
+ * each page's extents in order while collecting their before images,
+ * and logs them with one multi-extent record per page.
  */
-int StorageEngine::nextLSN() {
-  ++log_sequence_number;
-  return log_sequence_number;
+template <class LogDevice, class PageDevice>
+bool BasicStorageEngine<LogDevice, PageDevice>::writeBatch(int txid, vector<WriteRequest> writes) {
+    //as in write, every extent has to fit in a frame of a page that exists
+    for (unsigned i = 0; i < writes.size(); ++i)
+      if (writes[i].page_id < 1 || writes[i].page_id > page_device.count() ||
+          writes[i].offset < 0 || writes[i].offset + writes[i].input.length() > frame_size)
+        return false;
+    if (locking) {
+      for (unsigned i = 0; i < writes.size(); ++i)
+        if (!lock_mgr->lock(txid, writes[i].page_id, writes[i].offset, writes[i].input.length(), EXCLUSIVE))
+          return false;
+    }
+    lock_guard<recursive_mutex> guard(latch);
+    vector<int> page_order;
+    map<int, vector<UpdateExtent> > extents;
+    for (unsigned i = 0; i < writes.size(); ++i) {
+      if (extents.find(writes[i].page_id) == extents.end())
+        page_order.push_back(writes[i].page_id);
+      extents[writes[i].page_id].push_back(UpdateExtent(writes[i].offset, "", move(writes[i].input)));
+    }
+
+    for (unsigned p = 0; p < page_order.size(); ++p) {
+      int page_id = page_order[p];
+      vector<UpdateExtent>& page_extents = extents[page_id];
+      lm_ptr->lockPage(txid, page_id);
+      //extents may overlap, so each before image is taken after the
+      //earlier extents of the batch have been applied to a copy; the
+      //page itself only changes once the record is logged. Past the
+      //end of the page the before image is zeros, as in write.
+      int getindex = findPage(page_id);
+      if (getindex < 0)
+        return false;
+      string data(frameData(getindex), frame_desc[getindex].length);
+      for (unsigned i = 0; i < page_extents.size(); ++i) {
+        UpdateExtent& ext = page_extents[i];
+        if (data.size() < ext.offset + ext.afterImage.length())
+          data.resize(ext.offset + ext.afterImage.length(), '\0');
+        ext.beforeImage = data.substr(ext.offset, ext.afterImage.length());
+        data.replace(ext.offset, ext.afterImage.length(), ext.afterImage);
+      }
+      LSN pageLSN = lm_ptr->writeExtents(txid, page_id, move(page_extents));
+      updatePage(page_id, 0, data);
+      updateLSN(page_id, pageLSN);
+    }
+    return true;
+}
+
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::abort(int txid, int pages_allowed){
+  lock_guard<recursive_mutex> guard(latch);
+  page_writes_permitted = pages_allowed;
+  lm_ptr->abort(txid);
+}
+
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::observeLog(LSN end) {
+  log_end = max(log_end, end);
+}
+
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::setLogStart(LSN start) {
+  log_start = start;
+  log_end = start;
+}
+
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::permitPageWrites(int count) {
+  page_writes_permitted = count;
+}
+
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::setRepairing(bool on) {
+  repairing = on;
 }
 
 /*
- * store_master(int lsn)
+ * store_master(LSN lsn)
  *
  * Writes lsn to a particular location on the disk, returns true on success.
  */
-bool StorageEngine::store_master(int lsn) {
+template <class LogDevice, class PageDevice>
+bool BasicStorageEngine<LogDevice, PageDevice>::store_master(LSN lsn) {
     master_lsn = lsn;
     return true;
 }
@@ -157,7 +523,8 @@ bool StorageEngine::store_master(int lsn) {
  *
  * Gets lsn from a particular location on the disk (same as above)
  */
-int StorageEngine::get_master() {
+template <class LogDevice, class PageDevice>
+LSN BasicStorageEngine<LogDevice, PageDevice>::get_master() {
     return master_lsn;
 }
 
@@ -165,35 +532,30 @@ int StorageEngine::get_master() {
 /* 
 * Returns the LSN of a page.
 */
-int StorageEngine::getLSN(int page_id) {
+template <class LogDevice, class PageDevice>
+LSN BasicStorageEngine<LogDevice, PageDevice>::getLSN(int page_id) {
   int i = findPage(page_id);
-  return records[i].pageLSN;
+  return frame_desc[i].pageLSN;
 }
 
 /*
  * Return the filename of output file
  */
-string StorageEngine::getOutputFileName() {
+template <class LogDevice, class PageDevice>
+string BasicStorageEngine<LogDevice, PageDevice>::getOutputFileName() {
   return output_filename;
 }
 
 /* 
 * Returns as much of the log as is on disk
 */
-string StorageEngine::getLog() {
+template <class LogDevice, class PageDevice>
+string BasicStorageEngine<LogDevice, PageDevice>::getLog() {
 //read the file [log_filename] in as a string, and return that.
-    string wholefile, tmp;
-    
-    ifstream input(log_filename);
-    
-    while(!input.eof()) {
-        getline(input, tmp);
-	if (tmp != "") {
-	  wholefile += tmp;
-	  wholefile += "\n";
-	}
-    }
-    input.close();
+    syncLog();
+    string wholefile = log_device.read(0);
+    if (!wholefile.empty() && wholefile[wholefile.size()-1] != '\n')
+      wholefile += "\n";
     return wholefile;
     
 }
@@ -204,73 +566,347 @@ string StorageEngine::getLog() {
 * Writes to a page, if allowed.  If page_writes_permitted <= 0, this just 
 * returns false and doesn't write the page. 
 */
-bool StorageEngine::pageWrite(int page_id, int offset, string text, int lsn) {
-  if (page_writes_permitted <= 0) 
+template <class LogDevice, class PageDevice>
+bool BasicStorageEngine<LogDevice, PageDevice>::pageWrite(int page_id, int offset, string_view text, LSN lsn) {
+  if (!takePageWrite())
     return false;
-  --page_writes_permitted;
   updatePage(page_id, offset, text);
   updateLSN(page_id, lsn);
   return true;
 }
 
+template <class LogDevice, class PageDevice>
+bool BasicStorageEngine<LogDevice, PageDevice>::pageWrite(int page_id, const vector<UpdateExtent>& extents, LSN lsn) {
+  if (!takePageWrite())
+    return false;
+  for (unsigned i = 0; i < extents.size(); ++i)
+    updatePage(page_id, extents[i].offset, extents[i].afterImage);
+  updateLSN(page_id, lsn);
+  return true;
+}
+
+template <class LogDevice, class PageDevice>
+bool BasicStorageEngine<LogDevice, PageDevice>::installPage(int page_id, string image, LSN lsn) {
+  if (!takePageWrite())
+    return false;
+  int frame = -1;
+  for (unsigned i = 0; i < frame_order.size(); ++i)
+    if (frame_desc[frame_order[i]].page_id == page_id)
+      frame = frame_order[i];
+  if (frame == -1) {
+    //not buffered: take a frame without loading the old page
+    frame = takeFrame();
+    if (frame < 0)
+      return false;
+    frame_desc[frame].page_id = page_id;
+    frame_order.push_back(frame);
+  }
+  frame_desc[frame].length = 0;
+  updatePage(page_id, 0, image);
+  frame_desc[frame].pageLSN = lsn;
+  return true;
+}
+
+template <class LogDevice, class PageDevice>
+bool BasicStorageEngine<LogDevice, PageDevice>::getPageImage(int page_id, string& image) {
+  int i = findPage(page_id);
+  if (i < 0)
+    return false;
+  image.assign(frameData(i), frame_desc[i].length);
+  return true;
+}
+
 
 //private
 
+/*
+ * Appends "<LSN of the last record in log_entries>\t<ms since epoch>".
+ */
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::indexLogTime(const string& log_entries) {
+    size_t end = log_entries.size() - 1;
+    size_t start = log_entries.rfind('\n', end - 1);
+    start = (start == string::npos) ? 0 : start + 1;
+    long long now = chrono::duration_cast<chrono::milliseconds>(
+      chrono::system_clock::now().time_since_epoch()).count();
+    ofstream index(log_filename + ".times", ios::app);
+    index << strtoll(log_entries.c_str() + start, NULL, 10) << "\t" << now << "\n";
+}
+
+/*
+ * Writes every page on disk to fd from offset on, one write per page.
+ */
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::writePages(int fd, off_t offset) {
+  //Every page is its own write at its own offset, so the backend can
+  //keep several in flight and complete them together.
+  vector<char> data(frame_size);
+  for(int page_id = 1; page_id <= page_device.count(); ++page_id) {
+    LSN pageLSN;
+    unsigned length;
+    page_device.read(page_id, data.data(), pageLSN, length);
+    string line = to_string(pageLSN);
+    line += ' ';
+    line.append(data.data(), length);
+    line += '\n';
+    io->submitWrite(fd, IoBuffer(line), offset);
+    offset += line.size();
+  }
+}
+
+/*
+ * Writes as much of ship_backlog to ship_fd as it takes without blocking.
+ */
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::shipLog() {
+  size_t sent = 0;
+  while (ship_fd >= 0 && sent < ship_backlog.size()) {
+    ssize_t n = send(ship_fd, ship_backlog.data() + sent, ship_backlog.size() - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == ENOTSOCK)
+      n = ::write(ship_fd, ship_backlog.data() + sent, ship_backlog.size() - sent);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    sent += n;
+  }
+  ship_backlog.erase(0, sent);
+}
+
+/*
+ * Counts one pageWrite against page_writes_permitted.
+ * Returns false once none are left.
+ */
+template <class LogDevice, class PageDevice>
+bool BasicStorageEngine<LogDevice, PageDevice>::takePageWrite() {
+  if (repairing)
+    return true;
+  if (page_writes_permitted <= 0)
+    return false;
+  --page_writes_permitted;
+  return true;
+}
+
+/*
+ * Sizes the buffer pool for the pages on disk: every frame fits the
+ * largest page, rounded up to a whole number of cache lines. Any
+ * buffered pages are dropped.
+ */
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::allocateFrames() {
+  size_t largest = max<size_t>(page_device.largest(), 1);
+  frame_size = (largest + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+  free(frames);
+  frames = static_cast<char*>(aligned_alloc(CACHE_LINE, frame_size * MEMORY_SIZE));
+  frame_desc.assign(MEMORY_SIZE, FrameDesc());
+  frame_order.clear();
+}
+
+/*
+ * Frees every frame without writing anything back.
+ */
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::clearFrames() {
+  frame_desc.assign(MEMORY_SIZE, FrameDesc());
+  frame_order.clear();
+}
+
+/*
+ * Returns a free frame, evicting the most recently loaded page that is
+ * not pinned if there is none.
+ */
+template <class LogDevice, class PageDevice>
+int BasicStorageEngine<LogDevice, PageDevice>::takeFrame() {
+  if (frame_order.size() >= MEMORY_SIZE) {
+    for (int i = (int)frame_order.size() - 1; i >= 0; --i) {
+      if (frame_desc[frame_order[i]].pin_count == 0) {
+        flushPage(frame_desc[frame_order[i]].page_id);
+        break;
+      }
+    }
+  }
+  for (unsigned i = 0; i < frame_desc.size(); ++i)
+    if (frame_desc[i].page_id == -1)
+      return i;
+  return -1;
+}
+
 /* 
- * Returns the index of the specified page in the records vector.
- * If the desired page is not in the records vector, flushes some
- * other page from records to disk and reads the desired page
- * into records, then returns the index.
+ * Returns the frame holding the specified page.
+ * If the desired page is not buffered, flushes some other page to
+ * disk and reads the desired page into its frame, then returns the
+ * frame.
  *
- * return -1 if page not found in either records or onDisk
+ * return -1 if page not found in either the buffer or the page device
  */
-int StorageEngine::findPage(int page_id) {
-  if (page_id > (int)onDisk.size()) //page does not exist
+template <class LogDevice, class PageDevice>
+int BasicStorageEngine<LogDevice, PageDevice>::findPage(int page_id) {
+  if (page_id < 1 || page_id > page_device.count()) //page does not exist
     return -1;
 
-  for (unsigned i = 0; i < records.size(); ++i)
-      if (records[i].page_id == page_id)
-          return i;
-
-  // If did not return, that means page not found inside records.
-  if (records.size() >= MEMORY_SIZE){
-    Page p = records.back();
-    int page_id = p.page_id;
-    flushPage(page_id); 
+  for (unsigned i = 0; i < frame_order.size(); ++i) {
+      int frame = frame_order[i];
+      if (frame_desc[frame].page_id == page_id) {
+          if (frame_desc[frame].prefetched) {
+            frame_desc[frame].prefetched = false;
+            metrics.add("prefetch_hits", 1);
+            metrics.set("prefetch_hit_rate", metrics.get("prefetch_hits") / metrics.get("prefetch_pages"));
+          }
+          return frame;
+      }
   }
 
-  records.push_back(onDisk[page_id-1]);
-  return (int)records.size()-1;
+  // If did not return, that means page not buffered.
+  return loadPage(page_id);
+}
+
+/*
+ * Reads a page that is not buffered into a frame, and lets the LogMgr
+ * bring it up to date. Returns -1 if every frame is pinned.
+ */
+template <class LogDevice, class PageDevice>
+int BasicStorageEngine<LogDevice, PageDevice>::loadPage(int page_id) {
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  int frame = takeFrame();
+  if (frame < 0)
+    return -1;
+  page_device.read(page_id, frameData(frame), frame_desc[frame].pageLSN, frame_desc[frame].length);
+  frame_desc[frame].page_id = page_id;
+  frame_desc[frame].dirty = false;
+  frame_order.push_back(frame);
+  double us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+  metrics.add("buffer_pages_loaded", 1);
+  metrics.add("buffer_load_us", us);
+  metrics.set("buffer_load_us_per_page", metrics.get("buffer_load_us") / metrics.get("buffer_pages_loaded"));
+
+  //after an instant restart the log may still owe this page changes;
+  //they are redone before anyone sees it, outside the crash's budget
+  bool was_repairing = repairing;
+  repairing = true;
+  ++frame_desc[frame].pin_count;
+  lm_ptr->pageLoaded(page_id);
+  --frame_desc[frame].pin_count;
+  repairing = was_repairing;
+  return frame;
   
 }
 
 /* 
  * updatePage(int page_id, int offset, string text)
  *
+ * Frames never grow: write and writeBatch refuse text that would go
+ * past the end of the frame, and what is left of anything else is
+ * dropped. A gap between the end of the page and offset is zeroed.
  */
-void StorageEngine::updatePage(int page_id, int offset, string text) {
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::updatePage(int page_id, int offset, string_view text) {
   int i = findPage(page_id);
-  records[i].dirty = true;
-  //update records[i].data to have the specified text at the specified offset. 
-  records[i].data.replace(offset, text.length(), text);
-}
-
-void StorageEngine::flushPage(int page_id) {
-  //If the page's dirty bit is true, set it false and update this page in onDisk, 
-  //Remove it from the records vector
-  for (unsigned i = 0; i < records.size(); ++i){
-    if (records[i].page_id == page_id) {
-      if (records[i].dirty){
-	records[i].dirty = false;
-	lm_ptr->pageFlushed(page_id);
-	onDisk[page_id-1] = records[i];
+  frame_desc[i].dirty = true;
+  if ((size_t)offset > frame_desc[i].length)
+    memset(frameData(i) + frame_desc[i].length, 0,
+	   min((size_t)offset, frame_size) - frame_desc[i].length);
+  //copy text into the frame at the specified offset
+  size_t len = min(text.length(), frame_size - min((size_t)offset, frame_size));
+  memcpy(frameData(i) + offset, text.data(), len);
+  frame_desc[i].length = max((size_t)frame_desc[i].length, offset + len);
+}
+
+/*
+ * Frees the page's frame, writing the page back first if it is dirty,
+ * together with the dirty pages the page cleaner picks. A page that
+ * cannot be written keeps its frame.
+ */
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::flushPage(int page_id) {
+  for (unsigned i = 0; i < frame_order.size(); ++i){
+    int frame = frame_order[i];
+    if (frame_desc[frame].page_id == page_id) {
+      if (frame_desc[frame].dirty){
+	//the cleaner takes the pages evicted after this one
+	vector<int> batch(1, frame);
+	for (int j = (int)frame_order.size() - 1; j >= 0 && batch.size() <= cleaner_pages; --j) {
+	  const FrameDesc& desc = frame_desc[frame_order[j]];
+	  if (frame_order[j] != frame && desc.dirty && desc.pin_count == 0)
+	    batch.push_back(frame_order[j]);
+	}
+	writeBackFrames(batch);
+	//a page that could not be written stays buffered
+	if (frame_desc[frame].dirty)
+	  return;
       }
-      records.erase(records.begin() + i);
+      if (frame_desc[frame].prefetched)
+	metrics.add("prefetch_unused", 1);
+      frame_desc[frame] = FrameDesc();
+      frame_order.erase(frame_order.begin() + i);
+      return;
     }
+  }
+}
+
+/*
+ * Writes the dirty pages among the frames in batch to the page device,
+ * forcing the log once for all of them (see writeBack).
+ */
+template <class LogDevice, class PageDevice>
+int BasicStorageEngine<LogDevice, PageDevice>::writeBackFrames(vector<int> batch) {
+  vector<int> dirty_frames;
+  LSN flush_lsn = -1;
+  for (unsigned i = 0; i < batch.size(); ++i) {
+    if (frame_desc[batch[i]].dirty) {
+      dirty_frames.push_back(batch[i]);
+      flush_lsn = max(flush_lsn, frame_desc[batch[i]].pageLSN);
     }
+  }
+  if (dirty_frames.empty())
+    return 0;
+  //log first; the force is not part of the pages' cost
+  lm_ptr->pagesFlushed(flush_lsn);
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  sort(dirty_frames.begin(), dirty_frames.end(), [this](int a, int b) {
+    return frame_desc[a].page_id < frame_desc[b].page_id;
+  });
+  int runs = 0;
+  vector<int> written;
+  for (unsigned first = 0; first < dirty_frames.size(); ) {
+    unsigned last = first + 1;
+    while (last < dirty_frames.size() &&
+	   frame_desc[dirty_frames[last]].page_id == frame_desc[dirty_frames[last - 1]].page_id + 1)
+      ++last;
+    vector<Page> run;
+    for (unsigned i = first; i < last; ++i)
+      run.push_back(Page(frame_desc[dirty_frames[i]].page_id, frame_desc[dirty_frames[i]].pageLSN, false,
+			 string(frameData(dirty_frames[i]), frame_desc[dirty_frames[i]].length)));
+    //a run that may not have reached the device stays dirty
+    if (page_device.writeRun(move(run))) {
+      for (unsigned i = first; i < last; ++i) {
+	frame_desc[dirty_frames[i]].dirty = false;
+	written.push_back(frame_desc[dirty_frames[i]].page_id);
+      }
+    }
+    else
+      metrics.add("buffer_write_failures", 1);
+    ++runs;
+    first = last;
+  }
+  double us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+  lm_ptr->pagesWritten(written);
+  metrics.add("buffer_pages_flushed", written.size());
+  metrics.add("buffer_write_backs", 1);
+  metrics.add("buffer_write_runs", runs);
+  metrics.add("buffer_flush_us", us);
+  if (!written.empty())
+    metrics.set("buffer_flush_us_per_page", metrics.get("buffer_flush_us") / metrics.get("buffer_pages_flushed"));
+  return written.size();
 }
 
-void StorageEngine::updateLSN(int page_id, int newLSN) {
+template <class LogDevice, class PageDevice>
+void BasicStorageEngine<LogDevice, PageDevice>::updateLSN(int page_id, LSN newLSN) {
   int i = findPage(page_id);
-  records[i].pageLSN = newLSN;
+  frame_desc[i].pageLSN = newLSN;
 }
+
+template class BasicStorageEngine<FileLogDevice, MemoryPageDevice>;
+template class BasicStorageEngine<MemoryLogDevice, MemoryPageDevice>;
+template class BasicStorageEngine<FileLogDevice, FilePageDevice>;
+template class BasicStorageEngine<DirectLogDevice, DirectPageDevice>;
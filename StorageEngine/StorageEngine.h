@@ -1,62 +1,187 @@
 #ifndef STORAGEENGINE_H_
 #define STORAGEENGINE_H_
 
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
+#include <sys/types.h>
+#include "../StudentComponent/Metrics.h"
+#include "Devices.h"
 
-class LogMgr; 
+template <class Engine> class BasicLogMgr;
+class LockMgr;
+struct UpdateExtent;
 
-struct Page {
-    int page_id; //equal to the line number where it's stored in the file. 
-    int pageLSN;
+// A buffer pool frame's descriptor. The page itself lives in the
+// frame's slot of the pool's frame array.
+struct FrameDesc {
+    int page_id;       //-1 while the frame is free
+    LSN pageLSN;
     bool dirty;
-    std::string data;
+    int pin_count;     //pinned frames are never evicted
+    unsigned length;   //bytes of the frame the page uses
+    bool prefetched;   //loaded by prefetch and not asked for since
 
-    Page() {
+    FrameDesc() {
+        page_id = -1;
+        pageLSN = -1;
         dirty = false;
+        pin_count = 0;
+        length = 0;
+        prefetched = false;
     }
+};
+
+// One piece of a batched write: put input at offset of page page_id.
+struct WriteRequest {
+    int page_id;
+    int offset;
+    std::string input;
 
-    Page(int new_page_id, int new_pageLSN, bool new_dirty, std::string new_data) {
+    WriteRequest(int new_page_id, int new_offset, std::string new_input) {
         page_id = new_page_id;
-        pageLSN = new_pageLSN;
-        dirty = new_dirty;
-        data = new_data;
+        offset = new_offset;
+        input = std::move(new_input);
+    }
+};
+
+// What restoring a fuzzy backup needs to know (see LogMgr::backup).
+struct BackupInfo {
+    LSN checkpoint_lsn;   //the end_checkpoint taken as the backup began
+    LSN redo_lsn;         //oldest change that may be missing from the pages
+    LSN log_offset;       //the first record restore reads
+    long long time_ms;    //when the backup was taken, in ms since the epoch
+
+    BackupInfo() {
+        checkpoint_lsn = -1;
+        redo_lsn = -1;
+        log_offset = 0;
+        time_ms = 0;
     }
 };
 
-class StorageEngine {
+/*
+ * The engine is built around a log device and a page device (see
+ * Devices.h), chosen when it is compiled so that the calls into them
+ * need no indirection. The typedefs below name the combinations that
+ * are instantiated in StorageEngine.cpp.
+ */
+template <class LogDevice, class PageDevice>
+class BasicStorageEngine {
+
+    public:
+	typedef BasicLogMgr<BasicStorageEngine> LogMgrType;
 
     private:
-        // Memory for records, when crash clear records.
-        std::vector<Page> records;
-	std::vector<Page> onDisk; 
-	int log_sequence_number = 1;
-        int master_lsn = -1;
+        // The buffer pool: MEMORY_SIZE frames of frame_size bytes in one
+        // cache-line-aligned allocation, made when the database is read.
+        // Pages are copied into and out of their frame, which is never
+        // reallocated. When crash, free every frame.
+        char* frames;
+        size_t frame_size;
+        std::vector<FrameDesc> frame_desc;
+        // Buffered frames in the order their pages were loaded; eviction
+        // takes the last one that is not pinned.
+        std::vector<int> frame_order;
+	PageDevice page_device;
+	//The log holds LSNs [log_start, log_end), log_end counting the
+	//LogMgr's tail (see nextLSN).
+	LSN log_start = 0;
+	LSN log_end = 0;
+        LSN master_lsn = -1;
 	//Number of pageWrite calls permitted.
 	//Must be 0 until a crash.
 	int page_writes_permitted = 0;
-	LogMgr* lm_ptr;
+	LogMgrType* lm_ptr;
 	std::string log_filename;
         std::string output_filename;
+	std::string output_dir;
+	//All file writes go through io, the log device's included.
+	IoBackend* io;
+	std::string io_backend_name;
+	unsigned io_queue_depth;
+	LogDevice log_device;
+	//Durable log bytes not yet shipped to a standby, and where to.
+	int ship_fd;
+	std::string ship_backlog;
+	void shipLog();
+	//With log_time_index on, every log append also records the time
+	//its last record was handed to the disk in <log file>.times.
+	bool log_time_index;
+	void indexLogTime(const std::string& log_entries);
+	void writePages(int fd, off_t offset);
+	//See setRepairing.
+	bool repairing;
+	//Page locks, taken by writers before the latch when locking is on.
+	//The latch serializes everything else the engine does.
+	LockMgr* lock_mgr;
+	bool locking;
+	std::recursive_mutex latch;
+	void abortVictim(int txid);
+	bool takePageWrite();
 	const unsigned MEMORY_SIZE; //number of pages buffer can hold at once
+	Metrics metrics;
+	void allocateFrames();
+	void clearFrames();
+	char* frameData(int frame) {return frames + frame * frame_size;}
+	int takeFrame();
+	int loadPage(int page_id);
 	int findPage(int page_id); 
-	void updatePage(int page_id, int offset, std::string text);
+	void updatePage(int page_id, int offset, std::string_view text);
 	void flushPage(int page_id);
-	void updateLSN(int page_id, int newLSN);
+	//See setPageCleaner.
+	unsigned cleaner_pages;
+	int writeBackFrames(std::vector<int> batch);
+	void updateLSN(int page_id, LSN newLSN);
 
     public:
         // Constructor
-        StorageEngine();
+        BasicStorageEngine();
+        ~BasicStorageEngine();
+        BasicStorageEngine(const BasicStorageEngine&) = delete;
+        BasicStorageEngine& operator=(const BasicStorageEngine&) = delete;
+
+	/*
+	 * Chooses the I/O backend ("sync", "threads" or "uring"), or how
+	 * many writes it may keep in flight. Both wait for the old
+	 * backend's writes first.
+	 */
+	void setIoBackend(std::string name);
+	void setIoQueueDepth(unsigned queue_depth);
+
+	/*
+	 * Turns page locking on or off (see LockMgr). While on, write and
+	 * writeBatch lock what they write, and commit and abort release
+	 * the locks. Deadlock victims and timed-out waiters are aborted.
+	 */
+	void setLocking(bool on);
+	LockMgr* getLockMgr() {return lock_mgr;}
+
+	/*
+	 * Held by every entry point into the engine, so transactions may
+	 * run on several threads. Recursive, as the LogMgr calls back in.
+	 */
+	std::recursive_mutex& getLatch() {return latch;}
+
+	/*
+	 * The directory start() puts the log/ and dbs/ files under,
+	 * "output" unless set before start().
+	 */
+	void setOutputDir(std::string dir);
+	std::string getOutputDir() {return output_dir;}
 
 	/* 
 	 * Starts the storage engine with a database by reading the database
 	 * from a file.
 	 * Also sets the associated LogMgr and the logfile name.
 	 */
-	void start(std::string db_filename, LogMgr* log_mgr_ptr, std::string testcase_num);
+	void start(std::string db_filename, LogMgrType* log_mgr_ptr, std::string testcase_num);
 
 	/*
-	 * Ends the test case, writing onDisk to actual disk.
+	 * Ends the test case: lets the LogMgr finish recovery it left to
+	 * the background, then writes every page to db_filename.
 	 */
 	void end(std::string db_filename);
 
@@ -64,23 +189,135 @@ class StorageEngine {
 	 * Simulates a crash. 
 	 * Sets page_writes_permitted to safe_writes.
 	 * Replaces the old lm_ptr with log_mgr_ptr.
-	 * Empties the records vector (our page buffer).
+	 * Empties the buffer pool.
 	 * Reads the log from log_entries
 	 * Calls lm_ptr ->recover()
 	 */
-        void crash(int safe_writes, LogMgr* log_mgr_ptr);
-	void end_crash(LogMgr* log_mgr_ptr);
+        void crash(int safe_writes, LogMgrType* log_mgr_ptr);
+	void end_crash(LogMgrType* log_mgr_ptr);
+
+	/*
+	 * The LogMgr the engine is logging through.
+	 */
+	LogMgrType* getLogMgr() {return lm_ptr;}
 
 	/*
 	 * Appends the given string to the log file on disk.
 	 */
         void updateLog(std::string log_entries);
 
+	/*
+	 * Starts appending the given string to the log file and returns
+	 * without waiting. syncLog waits for every such append.
+	 */
+	void updateLogAsync(std::string log_entries);
+	bool syncLog();
+
+	/*
+	 * Ships the log to a standby through fd (a pipe or socket): first
+	 * the log already on disk, then every append once it is durable.
+	 * Writes never block; what fd cannot take yet is sent later.
+	 * -1 stops shipping. The caller keeps ownership of fd.
+	 */
+	void setLogShipFd(int fd);
+
+	/*
+	 * Returns the path of the log file.
+	 */
+	std::string getLogFileName();
+
+	/*
+	 * Returns the log on disk from the record at LSN from on.
+	 */
+	std::string getLogFrom(LSN from);
+
+	/*
+	 * Turns the log time index on or off, and looks up the last LSN
+	 * that was on its way to disk at time_ms (-1 if none was).
+	 */
+	void setLogTimeIndex(bool on);
+	LSN lsnAtTime(long long time_ms);
+
+	/*
+	 * Copies every page on disk to path, after a header holding info,
+	 * without stopping writers. Pages are copied as they are on disk,
+	 * so the copy is only consistent once the log is replayed over it.
+	 */
+	bool backup(std::string path, BackupInfo info);
+
+	/*
+	 * Replaces the pages on disk (and empties the buffer) with a backup
+	 * taken by backup(), and returns its header in info.
+	 */
+	bool loadBackup(std::string path, BackupInfo& info);
+
+	/*
+	 * Writes every dirty page in the buffer to disk and empties the
+	 * buffer. Returns false if some page could not be written; those
+	 * stay buffered, still dirty.
+	 */
+	bool flushAll();
+
+	/*
+	 * Writes the buffered dirty pages among page_ids (every buffered
+	 * dirty page, for writeBackAll) to disk as one batch: the log is
+	 * forced once, up to the newest of their pageLSNs, then the pages
+	 * are written in page id order, each run of consecutive ids in one
+	 * write. They stay buffered, clean, except for a run the page
+	 * device could not write, which stays dirty. Returns how many were
+	 * written.
+	 */
+	int writeBack(std::vector<int> page_ids);
+	int writeBackAll();
+
+	/*
+	 * With pages > 0, evicting a dirty page also writes back up to that
+	 * many other dirty, unpinned pages next in line for eviction, in
+	 * the same batch, so evicting them later costs no write or force.
+	 */
+	void setPageCleaner(unsigned pages);
+
+	/*
+	 * Loads pages into the buffer ahead of their use: the first
+	 * buffer pool's worth of page_ids (given in the order they will be
+	 * needed), read in page id order. Returns how many were loaded.
+	 * Buffered pages in keep are not evicted to make room; pages that
+	 * find no frame are left to be loaded when they are used.
+	 * The reads are synchronous; the page devices have no
+	 * asynchronous read path, so the gain is in batching and ordering
+	 * the loads, not in overlapping them with the caller's work.
+	 */
+	int prefetch(std::vector<int> page_ids, const std::vector<int>& keep = std::vector<int>());
+
+	/*
+	 * Number of pages the buffer pool holds.
+	 */
+	unsigned bufferFrames() {return MEMORY_SIZE;}
+
 	/*
 	 * Write to a page starting from the offset byte with the particular
-	 * transaction specified by txid.
+	 * transaction specified by txid. Returns false if txid was aborted
+	 * waiting for the page's lock instead, or, writing nothing, if the
+	 * write would not fit in a frame.
+	 */
+        bool write(int txid, int page_id, int offset, std::string_view input);
+
+	/*
+	 * Reads len bytes of a page from offset as transaction txid's
+	 * snapshot sees them (see LogMgr::snapshotRead), without blocking
+	 * or logging anything. Returns false if the snapshot is too old,
+	 * snapshot reads are off or the page does not exist.
 	 */
-        void write(int txid, int page_id, int offset, std::string input);
+	bool read(int txid, int page_id, int offset, int len, std::string& data);
+
+	/*
+	 * Applies a batch of writes for transaction txid. The writes may
+	 * touch one page or many; each page gets a single multi-extent
+	 * log record and is looked up only once. Every lock is taken before
+	 * anything is written; returns false if txid was aborted waiting,
+	 * or, writing nothing, if any write would not fit in a frame.
+	 */
+	bool writeBatch(int txid, std::vector<WriteRequest> writes);
 
 	/*
 	 * Sets the number of page writes allowed for this abort,
@@ -89,27 +326,58 @@ class StorageEngine {
 	void abort(int txid, int pages_allowed);
 
 	/*
-	 * Increments the log_sequence_number by 1 and returns it.
+	 * Returns the LSN the next log record gets: the end of the log,
+	 * counting the records still in the LogMgr's tail. Once a record
+	 * is in the tail, extendLog moves the end past its bytes (or past
+	 * what it grew by, for a record another update was folded into).
+	 */
+        LSN nextLSN() {return log_end;}
+	void extendLog(long long bytes) {log_end += bytes;}
+
+	/*
+	 * Makes sure nextLSN() is at least end. Used by a standby replaying
+	 * another engine's log, and by a restore.
 	 */
-        int nextLSN();
+	void observeLog(LSN end);
+
+	/*
+	 * The LSN of the first byte of the log file: 0 unless the log is
+	 * the tail of another engine's (see LogMgr::restore). Set it before
+	 * anything is logged.
+	 */
+	void setLogStart(LSN start);
+	LSN getLogStart() {return log_start;}
+
+	/*
+	 * Sets page_writes_permitted outside of a crash, so a standby can
+	 * redo pages while it follows a primary.
+	 */
+	void permitPageWrites(int count);
+
+	/*
+	 * While on, pageWrite and installPage do not count against
+	 * page_writes_permitted: recovery work done after the crash is
+	 * over, such as on-demand redo or background undo.
+	 */
+	void setRepairing(bool on);
 
 	/*
 	 * Writes lsn to a particular location on the disk.
 	 * Returns true on success.
 	 */
-	bool store_master(int lsn);
+	bool store_master(LSN lsn);
 
 	/*
 	 * Gets lsn from a particular location on the disk
 	 * (where store_master wrote it)
 	 */
-        int get_master();
+        LSN get_master();
         
 
 	/* 
 	 * Returns the LSN of a page.
 	 */
-        int getLSN(int page_id);
+        LSN getLSN(int page_id);
 
 	/*
 	 * Return the filename of output file
@@ -126,7 +394,44 @@ class StorageEngine {
 	* If page_writes_permitted <= 0, this just 
 	* returns false and doesn't write the page. 
 	*/
-        bool pageWrite(int page_id, int offset, std::string text, int lsn);
+        bool pageWrite(int page_id, int offset, std::string_view text, LSN lsn);
+
+	/*
+	 * Same as above, but applies every extent's after image to the page
+	 * and counts as a single page write.
+	 */
+	bool pageWrite(int page_id, const std::vector<UpdateExtent>& extents, LSN lsn);
+
+	/*
+	 * Replaces the whole page with image, if allowed (one page write).
+	 * The old contents are never read from disk. Returns false if the
+	 * write is not allowed or no frame can be freed for the page.
+	 */
+	bool installPage(int page_id, std::string image, LSN lsn);
+
+	/*
+	 * Puts the current contents of a page in image. Returns false if
+	 * the page does not exist or cannot be buffered.
+	 */
+	bool getPageImage(int page_id, std::string& image);
+
+	/*
+	 * buffer_pages_loaded and buffer_pages_flushed, and what a load
+	 * or flush costs per page. The flushed pages went out in
+	 * buffer_write_backs batches of buffer_write_runs writes.
+	 * prefetch_pages, and how many of those were asked for
+	 * (prefetch_hits) or evicted first (prefetch_unused).
+	 */
+	Metrics& getMetrics() {return metrics;}
 };
 
+// The engine the harness runs: a text log file, pages in memory.
+typedef BasicStorageEngine<FileLogDevice, MemoryPageDevice> StorageEngine;
+// Nothing touches a file; for microbenchmarks.
+typedef BasicStorageEngine<MemoryLogDevice, MemoryPageDevice> MemoryStorageEngine;
+// Log and pages in files, through the page cache.
+typedef BasicStorageEngine<FileLogDevice, FilePageDevice> FileStorageEngine;
+// Log and pages in files, with O_DIRECT.
+typedef BasicStorageEngine<DirectLogDevice, DirectPageDevice> DirectStorageEngine;
+
 #endif
@@ -1,10 +1,26 @@
 #include "StorageEngine.h"
+#include "LogShipping.h"
+#include "../StudentComponent/LockMgr.h"
 #include "../StudentComponent/LogMgr.h"
+#include "../StudentComponent/Standby.h"
 #include <vector>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <cstdlib>
+#include <climits>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+#include <glob.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 using namespace std;
 
@@ -14,28 +30,162 @@ using namespace std;
  * Destroys the running LogMgr instance
  * and replaces it with another LogMgr.
  * Calls se->crash(num, LogMgr).
+ * Every new LogMgr gets the harness's current options.
  */
-LogMgr* crash(vector<int> safe_writes, StorageEngine* se) {
+LogMgr* crash(vector<int> safe_writes, StorageEngine* se, LogMgrOptions options) {
   LogMgr* newLm = NULL;
   for (unsigned i = 0; i < safe_writes.size(); ++i)
     {
-      if (newLm)
-	delete newLm;
+      //se->crash stops the replaced LogMgr's log writer, so it is
+      //deleted only after that
+      LogMgr* oldLm = newLm;
       newLm = new LogMgr();
       newLm->setStorageEngine(se);
+      newLm->setOptions(options);
       se->crash(safe_writes[i], newLm);
+      delete oldLm;
     }
     return newLm;
 }
 
+/*
+ * setOption(options, se, name, value)
+ * Applies a <set name value> line of a testcase, either to the LogMgr
+ * options or to the storage engine. Unknown names are ignored.
+ */
+void setOption(LogMgrOptions& options, StorageEngine& se, string name, string value) {
+  if (name == "async_commit")
+    options.async_commit = (atoi(value.c_str()) != 0);
+  else if (name == "max_commit_lag")
+    options.max_commit_lag = atoi(value.c_str());
+  else if (name == "auto_checkpoint")
+    options.auto_checkpoint = (atoi(value.c_str()) != 0);
+  else if (name == "checkpoint_log_bytes")
+    options.checkpoint_log_bytes = atoll(value.c_str());
+  else if (name == "checkpoint_dpt_pages")
+    options.checkpoint_dpt_pages = atoi(value.c_str());
+  else if (name == "recovery_target_ms")
+    options.recovery_target_ms = atof(value.c_str());
+  else if (name == "checkpoint_min_log_bytes")
+    options.checkpoint_min_log_bytes = atoll(value.c_str());
+  else if (name == "full_page_images")
+    options.full_page_images = (atoi(value.c_str()) != 0);
+  else if (name == "log_page_flushes")
+    options.log_page_flushes = (atoi(value.c_str()) != 0);
+  else if (name == "parallel_parse_bytes")
+    options.parallel_parse_bytes = atoll(value.c_str());
+  else if (name == "parse_threads")
+    options.parse_threads = atoi(value.c_str());
+  else if (name == "instant_restart")
+    options.instant_restart = (atoi(value.c_str()) != 0);
+  else if (name == "background_redo_pages")
+    options.background_redo_pages = atoi(value.c_str());
+  else if (name == "background_undo")
+    options.background_undo = (atoi(value.c_str()) != 0);
+  else if (name == "background_undo_records")
+    options.background_undo_records = atoi(value.c_str());
+  else if (name == "restartable_recovery")
+    options.restartable_recovery = (atoi(value.c_str()) != 0);
+  else if (name == "recovery_checkpoint_pages")
+    options.recovery_checkpoint_pages = atoi(value.c_str());
+  else if (name == "delta_checkpoints")
+    options.delta_checkpoints = (atoi(value.c_str()) != 0);
+  else if (name == "checkpoint_full_every")
+    options.checkpoint_full_every = atoi(value.c_str());
+  else if (name == "coalesce_writes")
+    options.coalesce_writes = (atoi(value.c_str()) != 0);
+  else if (name == "log_writer")
+    options.log_writer = (atoi(value.c_str()) != 0);
+  else if (name == "log_writer_bytes")
+    options.log_writer_bytes = atoll(value.c_str());
+  else if (name == "log_writer_interval_ms")
+    options.log_writer_interval_ms = atof(value.c_str());
+  else if (name == "snapshot_reads")
+    options.snapshot_reads = (atoi(value.c_str()) != 0);
+  else if (name == "version_chain_bytes")
+    options.version_chain_bytes = atoll(value.c_str());
+  else if (name == "recovery_prefetch")
+    options.recovery_prefetch = (atoi(value.c_str()) != 0);
+  else if (name == "checkpoint_write_back")
+    options.checkpoint_write_back = (atoi(value.c_str()) != 0);
+  else if (name == "page_cleaner_pages")
+    se.setPageCleaner(atoi(value.c_str()));
+  else if (name == "io_backend")
+    se.setIoBackend(value);
+  else if (name == "io_queue_depth")
+    se.setIoQueueDepth(atoi(value.c_str()));
+  else if (name == "log_time_index")
+    se.setLogTimeIndex(atoi(value.c_str()) != 0);
+  else if (name == "lock_manager")
+    se.setLocking(atoi(value.c_str()) != 0);
+  else if (name == "lock_ranges")
+    se.getLockMgr()->setRangeLocks(atoi(value.c_str()) != 0);
+  else if (name == "lock_timeout_ms")
+    se.getLockMgr()->setTimeoutMs(atof(value.c_str()));
+}
+
+/*
+ * pullLog(primary, standby)
+ * Moves everything the primary has made durable to the standby,
+ * a pipe-full at a time if it has to.
+ */
+void pullLog(StorageEngine* primary, Standby* standby) {
+  primary->syncLog();
+  while (standby->fetch() > 0)
+    primary->syncLog();
+}
+
+/*
+ * restoreBackup(se, ...)
+ * Restores the backup at backup_path into a new engine, replaying se's
+ * log up to target_lsn, and writes the result to db<num>_restore.db.
+ */
+void restoreBackup(StorageEngine* se, string backup_path, LSN target_lsn,
+		   string db_filename, string testcase_num, LogMgrOptions options) {
+  StorageEngine restored;
+  restored.setOutputDir(se->getOutputDir());
+  LogMgr restored_lm;
+  restored_lm.setStorageEngine(&restored);
+  restored_lm.setOptions(options);
+  restored.start(db_filename, &restored_lm, testcase_num + "_restore");
+  BackupInfo info;
+  if (!restored.loadBackup(backup_path, info) ||
+      !restored_lm.restore(se->getLogFrom(info.log_offset), info, target_lsn))
+    return;
+  restored.flushAll();
+  restored.end(restored.getOutputFileName());
+}
+
+// What running one testcase took.
+struct TestcaseStats {
+  string name;
+  double wall_ms;
+  long long log_bytes;   //the primary's log at the end
+  double recovery_ms;    //spent in <crash ...> lines
+};
+
 // Assumption: 'correct' folder and student submission's folder has already be created.
 // Assumption: code will run in root eecs484 folder
-void runTestcase(string filename) {
+// Whatever the testcase prints goes to out, and its log and db files
+// under output_dir.
+TestcaseStats runTestcase(string filename, ostream& out, string output_dir = "output") {
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  TestcaseStats stats;
+  stats.name = filename;
+  stats.recovery_ms = 0;
   //Create an instance of StorageEngine called se.
-  StorageEngine se;
+  //se is the primary; after <standby promote> it is the standby's engine.
+  StorageEngine primary;
+  primary.setOutputDir(output_dir);
+  StorageEngine* se = &primary;
   //Create an instance of LogMgr called lm.
   LogMgr* lm = new LogMgr();
-  lm->setStorageEngine(&se);
+  lm->setStorageEngine(se);
+  LogMgrOptions options;
+  Standby* standby = NULL;
+  string backup_path;
+  bool promoted = false;
+  int ship_fd = -1;
   //open testcase file filename
   ifstream myfile;
   myfile.open(filename);
@@ -43,7 +193,8 @@ void runTestcase(string filename) {
   string db_filename;
   getline(myfile, db_filename);
   //Call se.start(db_filename)
-  se.start(db_filename, lm, filename.substr( filename.length() - 2 ));
+  string testcase_num = filename.substr( filename.length() - 2 );
+  se->start(db_filename, lm, testcase_num);
   //for the remaining lines in testcase:
   string contents;
   getline(myfile, contents);
@@ -68,16 +219,86 @@ void runTestcase(string filename) {
 	  crashint.push_back(i);
 	}
       }
-      lm=crash(crashint, &se);//return pointer?
-      se.end_crash(lm);
+      chrono::steady_clock::time_point crashed = chrono::steady_clock::now();
+      lm=crash(crashint, se, options);//return pointer?
+      se->end_crash(lm);
+      stats.recovery_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - crashed).count();
     }
     else if (ifcrash == "end") {
-      se.end(se.getOutputFileName());
+      se->end(se->getOutputFileName());
       break;
     } 
     else if (ifcrash == "checkpoint"){
 	lm->checkpoint();
     }
+    //<metrics> prints what the LogMgr, the buffer pool, the lock table
+    //(and the standby) have been counting
+    else if (ifcrash == "metrics"){
+      //a log writer thread may be counting too
+      lock_guard<recursive_mutex> guard(se->getLatch());
+      out << lm->getMetrics().toString();
+      out << se->getMetrics().toString();
+      out << se->getLockMgr()->getMetrics().toString();
+      if (standby && !promoted) {
+	standby->fetch();
+	out << standby->getMetrics().toString();
+      }
+    }
+    //<backup> takes an online backup; <restore lsn 40> (or <restore time
+    //<ms since epoch>>, or just <restore>) restores it up to that point
+    else if (ifcrash == "backup"){
+      backup_path = se->getOutputFileName() + ".backup";
+      lm->backup(backup_path);
+    }
+    else if (ifcrash == "restore" && backup_path != ""){
+      string by;
+      long long at;
+      LSN target_lsn = INT64_MAX;
+      if (ss >> by >> at)
+	target_lsn = (by == "time") ? se->lsnAtTime(at) : (LSN)at;
+      restoreBackup(se, backup_path, target_lsn, db_filename, testcase_num, options);
+    }
+    //<standby start pipe> starts a hot standby that is shipped the log
+    //over a pipe ("socket": a Unix socket; "file": it tails the log file).
+    //<standby catchup> applies what the primary has made durable, and
+    //<standby promote> fails over to the standby.
+    else if (ifcrash == "standby"){
+      string action;
+      ss >> action;
+      if (action == "start" && !standby) {
+	string kind;
+	ss >> kind;
+	LogSource* source = NULL;
+	int read_fd;
+	if (kind == "file")
+	  source = new FileLogSource(se->getLogFileName());
+	else if (openLogChannel(kind, ship_fd, read_fd)) {
+	  source = new FdLogSource(read_fd);
+	  se->setLogShipFd(ship_fd);
+	}
+	if (source)
+	  standby = new Standby(db_filename, testcase_num, source, options, output_dir);
+      }
+      else if (action == "catchup" && standby && !promoted) {
+	pullLog(se, standby);
+	standby->apply();
+      }
+      else if (action == "promote" && standby && !promoted) {
+	pullLog(se, standby);
+	se->setLogShipFd(-1);
+	delete lm;
+	lm = standby->promote();
+	se = standby->getStorageEngine();
+	promoted = true;
+      }
+    }
+    //if it looks like <set async_commit 1>, change that option
+    else if (ifcrash == "set"){
+      string name, value;
+      ss >> name >> value;
+      setOption(options, *se, name, value);
+      lm->setOptions(options);
+    }
     else{
       stringstream ss(contents);
       int firstnum;
@@ -85,28 +306,150 @@ void runTestcase(string filename) {
       string typechoose;
       ss >>typechoose;
       //if it looks like <1 commit>, call lm.commit(1)
+      //if it looks like <1 commit async>, call lm.commit(1, true)
       if (typechoose == "commit") {
-	lm->commit(firstnum);
+	string mode;
+	if (ss >> mode && mode == "async")
+	  lm->commit(firstnum, true);
+	else
+	  lm->commit(firstnum);
       }
       //if it looks like <1 abort 5>, call se.abort(1, 5)
       else if (typechoose == "abort"){
-	int pages_allowed;
+	int pages_allowed = 0;
 	ss >> pages_allowed;
-	se.abort(firstnum, pages_allowed);
+	se->abort(firstnum, pages_allowed);
       }
       //if it looks like <1 write 34 27 "ABC">,
       //Call se.write(1, 34, 27, "ABC")
+      //(a write that gave up waiting for its lock aborted 1)
       else if (typechoose == "write"){
 	int a,b;
 	string c;
 	ss >> a >> b >> c;
-	se.write(firstnum,a,b,c);
+	if (!se->write(firstnum,a,b,c))
+	  out << firstnum << " write " << a << " " << b << " aborted" << endl;
+      }
+      //if it looks like <2 read 34 27 3>, print what se.read(2, 34, 27, 3)
+      //finds in transaction 2's snapshot
+      else if (typechoose == "read"){
+	int a, b, c;
+	ss >> a >> b >> c;
+	string data;
+	out << firstnum << " read " << a << " " << b << " ";
+	if (se->read(firstnum, a, b, c, data))
+	  out << data << endl;
+	else if (!options.snapshot_reads)
+	  out << "snapshot reads off" << endl;
+	else
+	  out << "snapshot too old" << endl;
+      }
+      //if it looks like <1 writebatch 34 27 "ABC" 35 0 "DE">,
+      //Call se.writeBatch(1, {(34, 27, "ABC"), (35, 0, "DE")})
+      else if (typechoose == "writebatch"){
+	vector<WriteRequest> writes;
+	int a,b;
+	string c;
+	while (ss >> a >> b >> c) {
+	  writes.push_back(WriteRequest(a, b, c));
+	}
+	if (!se->writeBatch(firstnum, writes))
+	  out << firstnum << " writebatch aborted" << endl;
       }
     }
     getline(myfile, contents);
   }
   delete lm; lm = NULL;
+  delete standby;
+  if (ship_fd >= 0)
+    close(ship_fd);
   myfile.close();
+  stats.log_bytes = primary.getLog().size();
+  stats.wall_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+/*
+ * makeDirs(path)
+ * mkdir -p: creates path and every directory above it that is missing.
+ */
+void makeDirs(string path) {
+  for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+    mkdir(path.substr(0, slash).c_str(), 0755);
+    if (slash == string::npos)
+      break;
+  }
+}
+
+/*
+ * testcaseFiles(pattern)
+ * The testcases pattern names: every file in it if it is a directory,
+ * otherwise whatever it matches as a glob. Sorted by name.
+ */
+vector<string> testcaseFiles(string pattern) {
+  vector<string> files;
+  struct stat st;
+  if (stat(pattern.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+    DIR* dir = opendir(pattern.c_str());
+    while (struct dirent* entry = dir ? readdir(dir) : NULL) {
+      string path = pattern + "/" + entry->d_name;
+      if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+	files.push_back(path);
+    }
+    if (dir)
+      closedir(dir);
+  }
+  else {
+    glob_t matches;
+    if (glob(pattern.c_str(), 0, NULL, &matches) == 0)
+      for (size_t i = 0; i < matches.gl_pathc; ++i)
+	files.push_back(matches.gl_pathv[i]);
+    globfree(&matches);
+  }
+  sort(files.begin(), files.end());
+  return files;
+}
+
+/*
+ * runBatch(pattern, threads)
+ * Runs every testcase pattern names on a pool of threads, each in its
+ * own StorageEngine and LogMgr with its files (and what it prints, in
+ * stdout.txt) under output/batch/<testcase>/, then prints how long
+ * each took, how much log it wrote and how long its recoveries took.
+ */
+void runBatch(string pattern, unsigned threads) {
+  vector<string> files = testcaseFiles(pattern);
+  vector<TestcaseStats> stats(files.size());
+  atomic<size_t> next(0);
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  vector<thread> pool;
+  for (unsigned t = 0; t < max(1u, threads); ++t) {
+    pool.push_back(thread([&]() {
+      for (size_t i = next++; i < files.size(); i = next++) {
+	string name = files[i].substr(files[i].rfind('/') + 1);
+	string dir = "output/batch/" + name;
+	makeDirs(dir + "/log");
+	makeDirs(dir + "/dbs");
+	ofstream out(dir + "/stdout.txt");
+	stats[i] = runTestcase(files[i], out, dir);
+      }
+    }));
+  }
+  for (unsigned t = 0; t < pool.size(); ++t)
+    pool[t].join();
+  double wall_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+  cout << left << setw(32) << "testcase" << right << setw(12) << "wall ms"
+       << setw(12) << "log bytes" << setw(14) << "recovery ms" << endl;
+  double serial_ms = 0;
+  cout << fixed << setprecision(2);
+  for (unsigned i = 0; i < stats.size(); ++i) {
+    cout << left << setw(32) << stats[i].name << right << setw(12) << stats[i].wall_ms
+	 << setw(12) << stats[i].log_bytes << setw(14) << stats[i].recovery_ms << endl;
+    serial_ms += stats[i].wall_ms;
+  }
+  cout << stats.size() << " testcases on " << pool.size() << " threads in " << wall_ms
+       << " ms (" << serial_ms << " ms one after another)" << endl;
 }
 
 /*
@@ -114,7 +457,13 @@ void runTestcase(string filename) {
  * 
  */
 int main (int argc, char *argv[]) {
-    runTestcase(argv[1]);
+    //<main.o --batch testcases [threads]> runs a whole directory (or
+    //glob) of testcases at once
+    if (argc > 2 && string(argv[1]) == "--batch") {
+      runBatch(argv[2], argc > 3 ? atoi(argv[3]) : thread::hardware_concurrency());
+      return 0;
+    }
+    runTestcase(argv[1], cout);
 
     return 0;
 }
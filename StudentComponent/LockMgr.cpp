@@ -0,0 +1,200 @@
+#include "LockMgr.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+
+LockMgr::LockMgr() : range_locks(false), timeout_ms(1000) {}
+
+bool LockMgr::lock(int txid, int page_id, int offset, int len, LockMode mode) {
+  Request req;
+  req.txid = txid;
+  req.offset = range_locks ? offset : 0;
+  req.end = range_locks ? offset + len : INT_MAX;
+  req.mode = mode;
+  req.granted = false;
+
+  unique_lock<mutex> guard(table_mutex);
+  metrics.add("lock_requests", 1);
+  deque<Request>& queue = table[page_id];
+  //a lock it already holds may cover this one
+  for (unsigned i = 0; i < queue.size(); ++i) {
+    const Request& held = queue[i];
+    if (held.txid == txid && held.granted && held.offset <= req.offset && req.end <= held.end &&
+	(held.mode == EXCLUSIVE || mode == SHARED))
+      return true;
+  }
+  queue.push_back(req);
+  tx_pages[txid].insert(page_id);
+  if (grantable(queue, queue.size() - 1)) {
+    queue.back().granted = true;
+    return true;
+  }
+
+  metrics.add("lock_waits", 1);
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  chrono::steady_clock::time_point deadline = start +
+    chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double, milli>(timeout_ms));
+  bool granted = false, victim = false;
+  while (true) {
+    //the queue may have changed while we slept; find our request again
+    deque<Request>& waiting = table[page_id];
+    deque<Request>::iterator it = waiting.begin();
+    while (it != waiting.end() && !(it->txid == txid && it->offset == req.offset &&
+				    it->end == req.end && it->mode == mode))
+      ++it;
+    if (it == waiting.end())
+      break; //cleared under us
+    if (it->granted) {
+      granted = true;
+      break;
+    }
+    if (victims.count(txid)) {
+      victim = true;
+    }
+    else {
+      set<int> visited, cycle;
+      if (findCycle(txid, txid, visited, cycle)) {
+	metrics.add("deadlocks", 1);
+	int youngest = *cycle.rbegin();
+	if (youngest == txid) {
+	  victim = true;
+	}
+	else {
+	  victims.insert(youngest);
+	  released.notify_all();
+	}
+      }
+    }
+    if (!victim && chrono::steady_clock::now() >= deadline) {
+      metrics.add("lock_timeouts", 1);
+      victim = true;
+    }
+    if (victim) {
+      waiting.erase(it);
+      grantWaiting(waiting);
+      released.notify_all();
+      break;
+    }
+    released.wait_until(guard, deadline);
+  }
+  victims.erase(txid);
+
+  double us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+  metrics.add("lock_wait_us_total", us);
+  metrics.set("lock_wait_us_max", max(metrics.get("lock_wait_us_max"), us));
+  guard.unlock();
+  if (victim && on_victim)
+    on_victim(txid);
+  return granted;
+}
+
+void LockMgr::releaseAll(int txid) {
+  lock_guard<mutex> guard(table_mutex);
+  unordered_map<int, set<int> >::iterator pages = tx_pages.find(txid);
+  if (pages == tx_pages.end())
+    return;
+  for (set<int>::iterator page = pages->second.begin(); page != pages->second.end(); ++page) {
+    deque<Request>& queue = table[*page];
+    for (deque<Request>::iterator it = queue.begin(); it != queue.end(); ) {
+      if (it->txid == txid)
+	it = queue.erase(it);
+      else
+	++it;
+    }
+    grantWaiting(queue);
+    if (queue.empty())
+      table.erase(*page);
+  }
+  tx_pages.erase(pages);
+  released.notify_all();
+}
+
+void LockMgr::clear() {
+  lock_guard<mutex> guard(table_mutex);
+  table.clear();
+  tx_pages.clear();
+  victims.clear();
+  released.notify_all();
+}
+
+void LockMgr::setVictimHandler(VictimHandler handler) {
+  lock_guard<mutex> guard(table_mutex);
+  on_victim = handler;
+}
+
+void LockMgr::setRangeLocks(bool on) {
+  lock_guard<mutex> guard(table_mutex);
+  range_locks = on;
+}
+
+void LockMgr::setTimeoutMs(double ms) {
+  lock_guard<mutex> guard(table_mutex);
+  timeout_ms = ms;
+}
+
+Metrics LockMgr::getMetrics() {
+  lock_guard<mutex> guard(table_mutex);
+  return metrics;
+}
+
+//private
+
+bool LockMgr::conflicts(const Request& a, const Request& b) {
+  bool overlap = a.offset < b.end && b.offset < a.end;
+  return overlap && (a.mode == EXCLUSIVE || b.mode == EXCLUSIVE);
+}
+
+/*
+ * FIFO: a request waits for conflicting requests ahead of it even if
+ * they are only waiting themselves, so writers are not starved.
+ */
+bool LockMgr::grantable(deque<Request>& queue, size_t idx) {
+  for (size_t i = 0; i < idx; ++i)
+    if (queue[i].txid != queue[idx].txid && conflicts(queue[i], queue[idx]))
+      return false;
+  return true;
+}
+
+void LockMgr::grantWaiting(deque<Request>& queue) {
+  for (size_t i = 0; i < queue.size(); ++i)
+    if (!queue[i].granted && grantable(queue, i))
+      queue[i].granted = true;
+}
+
+/*
+ * The transactions txid's waiting request is queued behind.
+ */
+void LockMgr::waitsFor(int txid, set<int>& blockers) {
+  unordered_map<int, set<int> >::iterator pages = tx_pages.find(txid);
+  if (pages == tx_pages.end())
+    return;
+  for (set<int>::iterator page = pages->second.begin(); page != pages->second.end(); ++page) {
+    deque<Request>& queue = table[*page];
+    for (size_t i = 0; i < queue.size(); ++i) {
+      if (queue[i].txid != txid || queue[i].granted)
+	continue;
+      for (size_t j = 0; j < i; ++j)
+	if (queue[j].txid != txid && conflicts(queue[j], queue[i]))
+	  blockers.insert(queue[j].txid);
+    }
+  }
+}
+
+/*
+ * Depth-first search of the waits-for graph from txid back to start.
+ * Victims already chosen are about to let go, so their waits do not
+ * count. On success cycle holds every transaction on the way.
+ */
+bool LockMgr::findCycle(int start, int txid, set<int>& visited, set<int>& cycle) {
+  if (victims.count(txid))
+    return false;
+  set<int> blockers;
+  waitsFor(txid, blockers);
+  for (set<int>::iterator b = blockers.begin(); b != blockers.end(); ++b) {
+    if (*b == start || (visited.insert(*b).second && findCycle(start, *b, visited, cycle))) {
+      cycle.insert(txid);
+      return true;
+    }
+  }
+  return false;
+}
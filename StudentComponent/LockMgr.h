@@ -0,0 +1,104 @@
+#ifndef LOCKMGR_H_
+#define LOCKMGR_H_
+
+#include "Metrics.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+using namespace std;
+
+enum LockMode {SHARED, EXCLUSIVE};
+
+/* Called with the txid of a transaction chosen as a deadlock victim,
+   or whose lock wait timed out, so the caller can abort it. */
+typedef function<void(int)> VictimHandler;
+
+///////////////////  LockMgr  ///////////////////
+
+/*
+ * Page and byte-range locks for strict two-phase locking: a transaction
+ * locks what it writes and releases everything when it commits or
+ * aborts.
+ *
+ * The lock table hashes page ids to a FIFO queue of requests. A request
+ * is granted once it is compatible with every request ahead of it that
+ * overlaps it (shared locks are compatible with each other, and a
+ * transaction never conflicts with itself). A request that has to wait
+ * first looks for a cycle in the waits-for graph; if there is one, the
+ * youngest transaction in it (the largest txid) is the victim. A wait
+ * that outlasts the timeout also gives up.
+ *
+ * Unlike the rest of the engine this class is thread-safe, and lock()
+ * is meant to be called before any engine latch is taken.
+ */
+class LockMgr {
+ public:
+  LockMgr();
+
+  /*
+   * Locks [offset, offset + len) of page_id for txid, waiting if it has
+   * to. With range locks off, the whole page is locked. Returns false
+   * if txid was chosen as a deadlock victim or timed out, after
+   * handing it to the victim handler.
+   */
+  bool lock(int txid, int page_id, int offset, int len, LockMode mode);
+
+  /*
+   * Releases every lock txid holds or waits for.
+   */
+  void releaseAll(int txid);
+
+  /*
+   * Forgets every lock, as a crash does.
+   */
+  void clear();
+
+  void setVictimHandler(VictimHandler handler);
+  void setRangeLocks(bool on);
+  void setTimeoutMs(double ms);
+
+  /*
+   * lock_requests, lock_waits, lock_wait_us_total/_max, deadlocks and
+   * lock_timeouts. Returned by value, as other threads may be counting.
+   */
+  Metrics getMetrics();
+
+ private:
+  struct Request {
+    int txid;
+    int offset;
+    int end;
+    LockMode mode;
+    bool granted;
+  };
+
+  mutex table_mutex;
+  condition_variable released;
+  /* page id -> requests in arrival order */
+  unordered_map <int, deque<Request> > table;
+  /* tx -> pages it has requests on */
+  unordered_map <int, set<int> > tx_pages;
+  /* waiting transactions chosen as deadlock victims */
+  set <int> victims;
+  VictimHandler on_victim;
+  bool range_locks;
+  double timeout_ms;
+  Metrics metrics;
+
+  bool conflicts(const Request& a, const Request& b);
+  bool grantable(deque<Request>& queue, size_t idx);
+  void grantWaiting(deque<Request>& queue);
+  void waitsFor(int txid, set<int>& blockers);
+  bool findCycle(int start, int txid, set<int>& visited, set<int>& cycle);
+
+  LockMgr(const LockMgr&);
+  LockMgr& operator=(const LockMgr&);
+};
+
+///////////////////  End LockMgr  ///////////////////
+
+#endif
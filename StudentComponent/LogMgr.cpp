@@ -7,33 +7,39 @@
 //
 
 #include "LogMgr.h"
+#include "LockMgr.h"
 #include <string>
 #include <vector>
 #include <algorithm>
 #include <functional>
-#include <sstream>
 #include <queue>
+#include <thread>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 /**
  LogMgr can call a LogRecord's toString method to transform the LogRecord into a string, and then pass a string to StorageEngine::updateLog to append a string to the log on disk. 
  The log on disk will have one record per line; you can append multi-line strings to it if you want to add more than one record at once. 
  If LogMgr wants to read old log entries, it can call StorageEngine::getLog(), which will return a (multi-line) string. LogRecord::stringToRecordPtr can parse a line of that string and give you a pointer to a LogRecord of that line.
  */
 
-vector<LogRecord*> LogMgr::stringToLRVector(string logstring){
-    stringstream ss;
-    ss << logstring;
-    vector<LogRecord*> ret;
-    string holder;
-    
-    while (getline(ss, holder)) {
-        ret.push_back(LogRecord::stringToRecordPtr(holder));
+template <class Engine>
+vector<LogRecord*> BasicLogMgr<Engine>::stringToLRVector(const string& logstring, size_t from, size_t to){
+    to = min(to, logstring.size());
+    from = min(from, to);
+    /* big logs are parsed in line-aligned chunks on several threads */
+    unsigned threads = 1;
+    if ((long long)(to - from) >= options.parallel_parse_bytes) {
+        threads = options.parse_threads > 0 ? options.parse_threads : thread::hardware_concurrency();
     }
-    
-    return ret;
+    return LogRecord::stringToRecordVector(logstring.data() + from, logstring.data() + to, max(threads, 1u));
 }
 
 
-int LogMgr::getLastLSN(int txnum){
+template <class Engine>
+LSN BasicLogMgr<Engine>::getLastLSN(int txnum){
     /*
      * Find the LSN of the most recent log record for this TX.
      * If there is no previous log record for this TX, return
@@ -46,7 +52,8 @@ int LogMgr::getLastLSN(int txnum){
 }
 
 
-void LogMgr::setLastLSN(int txnum, int lsn){
+template <class Engine>
+void BasicLogMgr<Engine>::setLastLSN(int txnum, LSN lsn){
     /*
      * Update the TX table to reflect the LSN of the most recent
      * log entry for this transaction.
@@ -59,82 +66,320 @@ void LogMgr::setLastLSN(int txnum, int lsn){
  * maxLSN to disk. Don't forget to remove them from the
  * logtail once they're written!
  */
-void LogMgr::flushLogTail(int maxLSN){
-    string logs_to_flush;
-    auto it = logtail.begin();
+template <class Engine>
+void BasicLogMgr<Engine>::flushLogTail(LSN maxLSN){
+    /* anything the log writer handed over earlier is waited for too */
+    writeLogTail(maxLSN);
+    se->syncLog();
+    flushedLSN = max(flushedLSN, writtenLSN);
     
+    /* tell async committers whose commit record just hit the disk */
+    auto pc = pending_commits.begin();
+    while (pc != pending_commits.end() && pc->lsn <= flushedLSN) {
+        if (pc->on_durable) {
+            pc->on_durable(pc->txid, pc->lsn);
+        }
+        ++pc;
+    }
+    pending_commits.erase(pending_commits.begin(), pc);
+}
+
+template <class Engine>
+string BasicLogMgr<Engine>::takeLogTail(LSN maxLSN){
     /* get the records up to maxLSN */
-    while (it != logtail.end() && (*it)->getLSN() <= maxLSN) {
-        logs_to_flush.append((*it)->toString());
-        ++it;
+    vector<LogRecord*>::iterator it = upper_bound(logtail.begin(), logtail.end(), maxLSN,
+        [](LSN value, LogRecord* record) { return value < record->getLSN(); });
+    if (it == logtail.begin()) {
+        return string();
     }
-    se->updateLog(logs_to_flush);
+    size_t bytes = (it == logtail.end()) ? tail_text.size() :
+        (size_t)((*it)->getLSN() - logtail.front()->getLSN());
+    string logs = tail_text.substr(0, bytes);
+    tail_text.erase(0, bytes);
+    writtenLSN = max(writtenLSN, (*(it - 1))->getLSN());
     logtail.erase(logtail.begin(), it);
+    if (logtail.empty()) {
+        tail_timed = false;
+    }
+    return logs;
+}
+
+template <class Engine>
+void BasicLogMgr<Engine>::writeLogTail(LSN maxLSN){
+    string logs_to_write = takeLogTail(maxLSN);
+    se->updateLogAsync(logs_to_write);
+    bytes_since_checkpoint += logs_to_write.size();
+    metrics.add("log_bytes_flushed", logs_to_write.size());
+}
+
+template <class Engine>
+void BasicLogMgr<Engine>::appendLog(LogRecord* record){
+    if (options.log_writer && !tail_timed) {
+        tail_since = chrono::steady_clock::now();
+        tail_timed = true;
+    }
+    logtail.push_back(record);
+    size_t bytes = tail_text.size();
+    record->appendTo(tail_text);
+    se->extendLog(tail_text.size() - bytes);
+}
+
+template <class Engine>
+LogRecord* BasicLogMgr<Engine>::readRecord(const string& log, LSN lsn, unique_ptr<LogRecord>& parsed){
+    if (!logtail.empty() && lsn >= logtail.front()->getLSN()) {
+        vector<LogRecord*>::iterator it = lower_bound(logtail.begin(), logtail.end(), lsn,
+            [](LogRecord* record, LSN value) { return record->getLSN() < value; });
+        return (it != logtail.end() && (*it)->getLSN() == lsn) ? *it : nullptr;
+    }
+    LSN offset = lsn - se->getLogStart();
+    if (offset < 0 || offset >= (LSN)log.size()) {
+        return nullptr;
+    }
+    const char* begin = log.data() + offset;
+    const char* end = static_cast<const char*>(memchr(begin, '\n', log.size() - offset));
+    parsed.reset(LogRecord::parseRecord(begin, end ? end : log.data() + log.size()));
+    return parsed->getLSN() == lsn ? parsed.get() : nullptr;
+}
+
+/*
+ * The newest record is kept back when coalesce_writes may still fold
+ * the next update into it. Called after every logged operation and by
+ * the log writer thread, always holding the engine's latch.
+ */
+template <class Engine>
+void BasicLogMgr<Engine>::runLogWriter(){
+    size_t sealed = logtail.size() - (options.coalesce_writes ? 1 : 0);
+    if (!options.log_writer || logtail.empty() || sealed == 0) {
+        return;
+    }
+    long long bytes = (sealed == logtail.size()) ? (long long)tail_text.size() :
+        logtail[sealed]->getLSN() - logtail.front()->getLSN();
+    
+    bool by_size = bytes >= options.log_writer_bytes;
+    bool by_time = chrono::duration<double, milli>(chrono::steady_clock::now() - tail_since).count() >=
+        options.log_writer_interval_ms;
+    if (!by_size && !by_time) {
+        return;
+    }
+    writeLogTail(logtail[sealed - 1]->getLSN());
+    metrics.add("log_writer_writes", 1);
+    metrics.add(by_size ? "log_writer_writes_by_size" : "log_writer_writes_by_time", 1);
+}
+
+template <class Engine>
+void BasicLogMgr<Engine>::startLogWriter(){
+    if (writer_thread.joinable()) {
+        /* it has stopped, and let go of the latch */
+        writer_thread.join();
+    }
+    writer_running = true;
+    writer_thread = thread(&BasicLogMgr<Engine>::logWriterLoop, this);
+}
+
+template <class Engine>
+void BasicLogMgr<Engine>::logWriterLoop(){
+    unique_lock<recursive_mutex> lock(se->getLatch());
+    while (!writer_stop && options.log_writer && se->getLogMgr() == this) {
+        runLogWriter();
+        writer_wake.wait_for(lock, chrono::duration<double, milli>(options.log_writer_interval_ms));
+    }
+    writer_running = false;
+}
+
+template <class Engine>
+void BasicLogMgr<Engine>::afterLog(){
+    enforceCommitLag();
+    if (options.log_writer) {
+        /* a full tail is handed over right away; the writer thread
+           hands over one that has waited too long */
+        runLogWriter();
+        if (!writer_running) {
+            startLogWriter();
+        }
+    }
+    scheduleCheckpoint();
+    backgroundRedo(options.background_redo_pages);
+    backgroundUndo(options.background_undo_records);
+}
+
+/*
+ * The log writer: if the oldest pending async commit trails the newest
+ * log record by more than max_commit_lag log bytes, force the tail through
+ * the newest pending commit.
+ */
+template <class Engine>
+void BasicLogMgr<Engine>::enforceCommitLag(){
+    if (pending_commits.empty() || logtail.empty()) {
+        return;
+    }
+    if (logtail.back()->getLSN() - pending_commits.front().lsn > options.max_commit_lag) {
+        flushLogTail(pending_commits.back().lsn);
+    }
+}
+
+/*
+ * The checkpoint scheduler. Redo after a crash now would read roughly
+ * the log written since the last checkpoint and visit every page in
+ * the dirty page table; estimate that with the measured (or configured)
+ * costs and checkpoint before it grows past the recovery-time target.
+ */
+template <class Engine>
+void BasicLogMgr<Engine>::scheduleCheckpoint(){
+    if (!options.auto_checkpoint) {
+        return;
+    }
+    /* only what is on disk would have to be redone */
+    long long pending_bytes = bytes_since_checkpoint;
+    double us_per_byte = measured_us_per_byte >= 0 ? measured_us_per_byte : options.redo_us_per_byte;
+    double estimate_ms = (pending_bytes * us_per_byte +
+                          dirty_page_table.size() * options.redo_us_per_page) / 1000.0;
+    
+    metrics.set("scheduler_log_bytes_since_checkpoint", pending_bytes);
+    metrics.set("scheduler_dpt_pages", dirty_page_table.size());
+    metrics.set("scheduler_estimated_redo_ms", estimate_ms);
+    
+    string reason;
+    if (pending_bytes >= options.checkpoint_log_bytes) {
+        reason = "log_bytes";
+    }
+    else if (pending_bytes < options.checkpoint_min_log_bytes) {
+        return;
+    }
+    else if ((int)dirty_page_table.size() - dpt_pages_at_checkpoint >= options.checkpoint_dpt_pages) {
+        reason = "dpt_pages";
+    }
+    else if (estimate_ms >= options.recovery_target_ms) {
+        reason = "redo_estimate";
+    }
+    else {
+        return;
+    }
+    metrics.add("scheduler_checkpoints", 1);
+    metrics.add("scheduler_checkpoints_by_" + reason, 1);
+    checkpoint();
 }
 
 /*
- * Run the analysis phase of ARIES.
+ * Run the analysis phase of ARIES. LSNs are log byte offsets, so the
+ * last checkpoint (and the base of each delta) is read where its LSN
+ * says, and only the log from the checkpoint on is parsed and scanned.
  */
-void LogMgr::analyze(vector <LogRecord*> log){
+template <class Engine>
+vector<LogRecord*> BasicLogMgr<Engine>::analyze(const string& log){
     /* 1. get most recent checkpoint */
-    int lsn_checkpoint = se->get_master();
+    LSN lsn_checkpoint = se->get_master();
 
     /* 2. recover TxTable, DPT from most recent checkpoint (if exists)
         */
+    vector<LogRecord*> records;
     int log_index = 0;
-    if (lsn_checkpoint == -1) {
+    if (lsn_checkpoint == NULL_LSN) {
         // TxTable and DPT should be empty
         tx_table.clear();
         dirty_page_table.clear();
+        records = stringToLRVector(log);
     }
     else{
-        while (log[log_index]->getLSN() < lsn_checkpoint) {
-            log_index++;
+        records = stringToLRVector(log, lsn_checkpoint - se->getLogStart());
+        /* a delta checkpoint only holds what changed since its base:
+           go back to the last full one, then apply the deltas oldest
+           first */
+        vector<DeltaChkptLogRecord*> deltas;
+        vector<unique_ptr<LogRecord> > bases;
+        LogRecord* base = records[0];
+        while (base->getType() == TxType::DELTA_CKPT) {
+            DeltaChkptLogRecord* delta = dynamic_cast<DeltaChkptLogRecord*>(base);
+            deltas.push_back(delta);
+            bases.push_back(unique_ptr<LogRecord>());
+            base = readRecord(log, delta->getBaseLSN(), bases.back());
         }
-        ChkptLogRecord* checkpoint = dynamic_cast<ChkptLogRecord*>(log[log_index]);
+        ChkptLogRecord* checkpoint = dynamic_cast<ChkptLogRecord*>(base);
         tx_table = checkpoint->getTxTable();
         dirty_page_table = checkpoint->getDirtyPageTable();
+        for (int i = (int)deltas.size() - 1; i >= 0; i--) {
+            deltas[i]->applyTo(tx_table, dirty_page_table);
+        }
+        metrics.set("analysis_checkpoint_deltas", deltas.size());
         log_index++;
     }
     
     /* 3. scan forward */
-    for (; log_index < log.size(); log_index++) {
-        LogRecord* this_record = log[log_index];
+    for (; log_index < records.size(); log_index++) {
+        analyzeRecord(records[log_index]);
+    }
+    metrics.set("analysis_dpt_pages", dirty_page_table.size());
+    return records;
+}
 
-        if (this_record->getType() == TxType::END) {
-            /* REMOVE from TxTable */
-            if (tx_table.find(this_record->getTxID()) != tx_table.end()) {
-                tx_table.erase(this_record->getTxID());
-            }
+template <class Engine>
+LSN BasicLogMgr<Engine>::redoStartLSN(){
+    LSN lsn_start = NULL_LSN;
+    for (auto it = dirty_page_table.begin(); it != dirty_page_table.end(); ++it) {
+        if (lsn_start == NULL_LSN || it->second < lsn_start) {
+            lsn_start = it->second;
+        }
+    }
+    return lsn_start;
+}
+
+/*
+ * The page a log record changes, or -1 if it changes none.
+ */
+static int pageOf(LogRecord* record){
+    switch (record->getType()) {
+        case TxType::UPDATE:
+            return dynamic_cast<UpdateLogRecord*>(record)->getPageID();
+        case TxType::CLR:
+            return dynamic_cast<CompensationLogRecord*>(record)->getPageID();
+        case TxType::MULTI_UPDATE:
+            return dynamic_cast<MultiUpdateLogRecord*>(record)->getPageID();
+        case TxType::PAGE_IMAGE:
+            return dynamic_cast<PageImageLogRecord*>(record)->getPageID();
+        default:
+            return -1;
+    }
+}
+
+/*
+ * One step of the analysis forward scan: fold a record into the
+ * Tx table and the dirty page table.
+ */
+template <class Engine>
+void BasicLogMgr<Engine>::analyzeRecord(LogRecord* this_record){
+    if (this_record->getType() == TxType::PAGE_FLUSH) {
+        /* every change logged before it is on the page on disk; a
+           later change puts the page back in the table */
+        dirty_page_table.erase(dynamic_cast<PageFlushLogRecord*>(this_record)->getPageID());
+        return;
+    }
+    else if (this_record->getType() == TxType::PAGE_IMAGE) {
+        /* belongs to no transaction; it only dirties its page */
+    }
+    else if (this_record->getType() == TxType::END) {
+        /* REMOVE from TxTable */
+        if (tx_table.find(this_record->getTxID()) != tx_table.end()) {
+            tx_table.erase(this_record->getTxID());
+        }
+        return;
+    }
+    else{
+        /* 3.1 update Tx Table */
+        setLastLSN(this_record->getTxID(), this_record->getLSN());
+        if (this_record->getType() == TxType::COMMIT) {
+            tx_table[this_record->getTxID()].status = TxStatus::C;
         }
         else{
-            /* 3.1 update Tx Table */
-            setLastLSN(this_record->getTxID(), this_record->getLSN());
-            if (this_record->getType() == TxType::COMMIT) {
-                tx_table[this_record->getTxID()].status = TxStatus::C;
-            }
-            else{
-                tx_table[this_record->getTxID()].status = TxStatus::U;
-            }
-            
-            /* 3.2 update dirty page table
-              only if type= Update/CLR */
-            int page_id = -1;
-            if (this_record->getType() == TxType::UPDATE) {
-                UpdateLogRecord* update = dynamic_cast<UpdateLogRecord*>(this_record);
-                page_id = update->getPageID();
-            }
-            else if (this_record->getType() == TxType::CLR){
-                CompensationLogRecord* clr = dynamic_cast<CompensationLogRecord*>(this_record);
-                page_id = clr->getPageID();
-            }
-            
-            if (page_id != -1 && dirty_page_table.find(page_id) == dirty_page_table.end()) {
-                /* if this is an update/clr, and DPT has no entry */
-                dirty_page_table[page_id] = this_record->getLSN();
-            }
+            tx_table[this_record->getTxID()].status = TxStatus::U;
         }
     }
+    
+    /* 3.2 update dirty page table
+      only if the record changes a page */
+    int page_id = pageOf(this_record);
+    if (page_id != -1 && dirty_page_table.find(page_id) == dirty_page_table.end()) {
+        /* if this is an update/clr, and DPT has no entry */
+        dirty_page_table[page_id] = this_record->getLSN();
+    }
 }
 
 /*
@@ -142,7 +387,8 @@ void LogMgr::analyze(vector <LogRecord*> log){
  * If the StorageEngine stops responding aka pageWrite = false, return false.
  * Else when redo phase is complete, return true.
  */
-bool LogMgr::redo(vector <LogRecord*> log){
+template <class Engine>
+bool BasicLogMgr<Engine>::redo(vector <LogRecord*> log){
 
     if (dirty_page_table.empty()) {
         /* nothing to do */
@@ -150,66 +396,267 @@ bool LogMgr::redo(vector <LogRecord*> log){
     }
     else{
         /* find the smallest lsn in DPT */
-        auto it = dirty_page_table.begin();
-        int lsn_start = it->second;
-        ++it;
-        
-        while (it != dirty_page_table.end()) {
-            lsn_start = min(it->second, lsn_start);
-            ++it;
-        }
+        LSN lsn_start = redoStartLSN();
+        /* pages written back during redo leave the live table, but
+           their later records still have to be looked at */
+        map<int, LSN> dpt = dirty_page_table;
         
         int idx = 0;
         while (idx < log.size() && log[idx]->getLSN() < lsn_start) {++idx;}
+        metrics.set("redo_start_lsn", lsn_start);
+        if (options.recovery_prefetch) {
+            map<int, int> uses;
+            vector<int> order = redoPages(log, idx, uses);
+            startPrefetch(order, uses);
+        }
+        metrics.set("redo_records_examined", 0);
+        
+        /* the last full page image of each page in the redo range */
+        map<int, int> image_idx;
+        for (int i = idx; i < log.size(); i++) {
+            if (log[i]->getType() == TxType::PAGE_IMAGE) {
+                image_idx[dynamic_cast<PageImageLogRecord*>(log[i])->getPageID()] = i;
+            }
+        }
         
+        int redone_since_checkpoint = 0;
         for (; idx < log.size(); idx++) {
-            int page_id, lsn_now, offset;
-            string to_write;
+            int page_id;
+            LSN lsn_now;
 
             /* 1. check if in dirty_page_table */
             /* 2. check if needs to write */
             /* 3. read the actual lsn from disk, check if need to update */
             /* 3.1 if yes, apply update, and update the page's lsn in disk */
             
-
-            if(log[idx]->getType() == TxType::UPDATE){
-                UpdateLogRecord* holder = dynamic_cast<UpdateLogRecord*>(log[idx]);
-                page_id = holder->getPageID();
-                lsn_now = holder->getLSN();
-                offset = holder->getOffset();
-                to_write = holder->getAfterImage();
-            }
-            else if(log[idx]->getType() == TxType::CLR){
-                CompensationLogRecord* holder = dynamic_cast<CompensationLogRecord*>(log[idx]);
-                page_id = holder->getPageID();
-                lsn_now = holder->getLSN();
-                offset = holder->getOffset();
-                to_write = holder->getAfterImage();
+            TxType type = log[idx]->getType();
+            page_id = pageOf(log[idx]);
+            if (page_id == -1) {
+                continue;
             }
-            else{
+            lsn_now = log[idx]->getLSN();
+            
+            auto rec_lsn = dpt.find(page_id);
+            if (rec_lsn == dpt.end() || rec_lsn->second > lsn_now) {
                 continue;
             }
+            metrics.add("redo_records_examined", 1);
+            prefetchFor(page_id);
             
-            if (dirty_page_table.find(page_id) != dirty_page_table.end() &&
-                dirty_page_table[page_id] <= lsn_now &&
-                se->getLSN(page_id) < lsn_now
-                ) {
-                /* if pageWrite fail, return false */
-                if(se->pageWrite(page_id, offset, to_write, lsn_now) == false){
-                    return false;
+            auto image = image_idx.find(page_id);
+            if (image != image_idx.end() &&
+                log[image->second]->getLSN() >= rec_lsn->second) {
+                /* the page is rebuilt from its image: everything before the
+                   image is already in it, everything after is replayed
+                   without reading the page's LSN */
+                if (idx < image->second) {
+                    continue;
                 }
             }
+            else if (type == TxType::PAGE_IMAGE || se->getLSN(page_id) >= lsn_now) {
+                continue;
+            }
+            
+            /* if pageWrite fail, return false */
+            if (redoRecord(log[idx]) == false) {
+                startPrefetch(vector<int>());
+                return false;
+            }
+            if (options.restartable_recovery &&
+                ++redone_since_checkpoint >= options.recovery_checkpoint_pages) {
+                redoCheckpoint(idx + 1 < log.size() ? log[idx + 1]->getLSN() : NULL_LSN);
+                redone_since_checkpoint = 0;
+            }
         }// end:for
+        startPrefetch(vector<int>());
     }
 
-    /* write an end for every commited Tx */
-    for (auto it : tx_table) {
-        if (it.second.status == TxStatus::C) {
-            logtail.push_back(new LogRecord(se->nextLSN(), it.second.lastLSN, it.first, TxType::END));
-            tx_table.erase(it.first);
+    endCommitted();
+    return true;
+}
+
+/*
+ * The pages of the records redo will examine, first use first, and
+ * how many of those records each page has. The images redo may skip
+ * over are not worth telling apart here.
+ */
+template <class Engine>
+vector<int> BasicLogMgr<Engine>::redoPages(vector <LogRecord*>& log, int idx, map<int, int>& uses){
+    vector<int> pages;
+    for (; idx < log.size(); idx++) {
+        int page_id = pageOf(log[idx]);
+        auto dpt = dirty_page_table.find(page_id);
+        if (dpt == dirty_page_table.end() || dpt->second > log[idx]->getLSN()) {
+            continue;
+        }
+        if (uses[page_id]++ == 0) {
+            pages.push_back(page_id);
+        }
+    }
+    return pages;
+}
+
+/*
+ * Follows the chains the way undo will, newest LSN first, and collects
+ * the pages of the updates on them.
+ */
+template <class Engine>
+vector<int> BasicLogMgr<Engine>::undoPages(const string& log, priority_queue<LSN> lsns, map<int, int>* uses){
+    vector<int> pages;
+    set<int> seen;
+    while (!lsns.empty()) {
+        LSN lsn = lsns.top();  lsns.pop();
+        unique_ptr<LogRecord> parsed;
+        LogRecord* record = readRecord(log, lsn, parsed);
+        if (record == nullptr) {
+            continue;
+        }
+        LSN next = record->getprevLSN();
+        if (record->getType() == TxType::CLR) {
+            next = dynamic_cast<CompensationLogRecord*>(record)->getUndoNextLSN();
+        }
+        else if (record->getType() == TxType::UPDATE || record->getType() == TxType::MULTI_UPDATE) {
+            if (seen.insert(pageOf(record)).second) {
+                pages.push_back(pageOf(record));
+            }
+            if (uses) {
+                (*uses)[pageOf(record)]++;
+            }
+        }
+        if (next != NULL_LSN) {
+            lsns.push(next);
+        }
+    }
+    return pages;
+}
+
+template <class Engine>
+void BasicLogMgr<Engine>::startPrefetch(vector<int> order, map<int, int> uses){
+    prefetch_order = order;
+    prefetch_uses = uses;
+    prefetch_pos.clear();
+    for (unsigned i = 0; i < prefetch_order.size(); i++) {
+        prefetch_pos[prefetch_order[i]] = i;
+    }
+    prefetch_next = 0;
+}
+
+template <class Engine>
+void BasicLogMgr<Engine>::prefetchFor(int page_id){
+    auto pos = prefetch_pos.find(page_id);
+    if (pos == prefetch_pos.end()) {
+        return;
+    }
+    while (prefetch_next <= pos->second && prefetch_next < prefetch_order.size()) {
+        vector<int> window(prefetch_order.begin() + prefetch_next, prefetch_order.end());
+        /* pages already handed over that the phase still needs must
+           not make room for the window */
+        vector<int> keep;
+        for (unsigned i = 0; i < prefetch_next; i++) {
+            if (prefetch_uses[prefetch_order[i]] > 0) {
+                keep.push_back(prefetch_order[i]);
+            }
+        }
+        se->prefetch(window, keep);
+        /* the engine takes at most a buffer pool's worth */
+        prefetch_next += min<size_t>(window.size(), se->bufferFrames());
+    }
+    prefetch_uses[page_id]--;
+}
+
+/*
+ * Instant restart: sorts the records redo would look at into one list
+ * per page. Records before a page's last full image are dropped, as
+ * redo would skip them.
+ */
+template <class Engine>
+void BasicLogMgr<Engine>::planRedo(vector <LogRecord*> log){
+    for (int idx = 0; idx < log.size(); idx++) {
+        int page_id = pageOf(log[idx]);
+        if (page_id == -1) {
+            continue;
+        }
+        auto dpt = dirty_page_table.find(page_id);
+        if (dpt == dirty_page_table.end() || dpt->second > log[idx]->getLSN()) {
+            continue;
+        }
+        if (log[idx]->getType() == TxType::PAGE_IMAGE) {
+            pending_redo[page_id].clear();
+        }
+        pending_redo[page_id].push_back(log[idx]);
+    }
+}
+
+/*
+ * Every page redo has loaded so far is either still in the buffer or
+ * was evicted up to date, so once the buffer is written back the redo
+ * done before redo_from is on disk. Pages keep their dirty page table
+ * entries, but none of them needs redo before redo_from: the LSN of
+ * the next record redo reads, or NULL_LSN if it has read them all.
+ */
+template <class Engine>
+void BasicLogMgr<Engine>::redoCheckpoint(LSN redo_from){
+    map<int, LSN> dpt = dirty_page_table;
+    if (!se->flushAll()) {
+        /* a page that could not be written still needs its redo */
+        return;
+    }
+    if (redo_from == NULL_LSN) {
+        /* where the checkpoint goes */
+        redo_from = se->nextLSN();
+    }
+    for (auto it = dpt.begin(); it != dpt.end(); ++it) {
+        dirty_page_table[it->first] = max(it->second, redo_from);
+    }
+    checkpoint();
+    metrics.add("recovery_checkpoints", 1);
+}
+
+/*
+ * Reapplies one record's change to its page.
+ * Returns false if the StorageEngine refused the page write.
+ */
+template <class Engine>
+bool BasicLogMgr<Engine>::redoRecord(LogRecord* record){
+    LSN lsn_now = record->getLSN();
+    switch (record->getType()) {
+        case TxType::UPDATE: {
+            UpdateLogRecord* holder = dynamic_cast<UpdateLogRecord*>(record);
+            return se->pageWrite(holder->getPageID(), holder->getOffset(), holder->getAfterImage(), lsn_now);
+        }
+        case TxType::CLR: {
+            CompensationLogRecord* holder = dynamic_cast<CompensationLogRecord*>(record);
+            return se->pageWrite(holder->getPageID(), holder->getOffset(), holder->getAfterImage(), lsn_now);
+        }
+        case TxType::MULTI_UPDATE: {
+            /* all extents go to the page as one page write */
+            MultiUpdateLogRecord* holder = dynamic_cast<MultiUpdateLogRecord*>(record);
+            return se->pageWrite(holder->getPageID(), holder->getExtents(), lsn_now);
+        }
+        case TxType::PAGE_IMAGE: {
+            PageImageLogRecord* holder = dynamic_cast<PageImageLogRecord*>(record);
+            return se->installPage(holder->getPageID(), holder->getImage(), lsn_now);
+        }
+        default:
+            return true;
+    }
+}
+
+/*
+ * Write an end for every committed Tx and drop it from the Tx table.
+ */
+template <class Engine>
+void BasicLogMgr<Engine>::endCommitted(){
+    auto tx_it = tx_table.begin();
+    while (tx_it != tx_table.end()) {
+        if (tx_it->second.status == TxStatus::C) {
+            appendLog(new LogRecord(se->nextLSN(), tx_it->second.lastLSN, tx_it->first, TxType::END));
+            tx_it = tx_table.erase(tx_it);
+        }
+        else{
+            ++tx_it;
         }
     }
-    return true;
 }
 
 /*
@@ -217,8 +664,9 @@ bool LogMgr::redo(vector <LogRecord*> log){
  * If a txnum is provided, abort that transaction.
  * Hint: the logic is very similar for these two tasks!
  */
-void LogMgr::undo(vector <LogRecord*> log, int txnum){
-    priority_queue<int> toUndo; // lsns to undo
+template <class Engine>
+void BasicLogMgr<Engine>::undo(const string& log, int txnum){
+    priority_queue<LSN> toUndo; // lsns to undo
     
     if (txnum != NULL_TX) {
         if (tx_table.find(txnum) == tx_table.end()) {
@@ -236,74 +684,135 @@ void LogMgr::undo(vector <LogRecord*> log, int txnum){
             it++;
         }
     }
-    int idx = log.size() - 1;
-    while (toUndo.size() > 0 && idx >= 0) {
-        int lsn_now = toUndo.top();  toUndo.pop();
+    while (toUndo.size() > 0) {
+        if (undoNext(log, toUndo) == false) {
+            return;
+        }
+        if (options.restartable_recovery && !logtail.empty()) {
+            /* the CLR is the progress record; it has to outlive a crash */
+            flushLogTail(logtail.back()->getLSN());
+        }
+    }
+}
+
+/*
+ * One step of undo: handles the record with the largest LSN in toUndo,
+ * read where its LSN points. Returns false if undo has to stop because
+ * the StorageEngine refused a page write.
+ */
+template <class Engine>
+bool BasicLogMgr<Engine>::undoNext(const string& log, priority_queue<LSN>& toUndo){
+    LSN lsn_now = toUndo.top();  toUndo.pop();
+    
+    unique_ptr<LogRecord> parsed;
+    LogRecord* record = readRecord(log, lsn_now, parsed);
+    if (record == nullptr) {
+        return false; // should not reach here
+    }
+    
+    if (record->getType() == TxType::CLR) {
+        /* if this is a CLR */
+        CompensationLogRecord* holder = dynamic_cast<CompensationLogRecord*>(record);
+        if (holder->getUndoNextLSN() == NULL_LSN) {
+            /* write an end for this Tx */
+            appendLog(new LogRecord(se->nextLSN(), getLastLSN(holder->getTxID()), holder->getTxID(), TxType::END));
+            tx_table.erase(holder->getTxID());
+            return true;
+        }
+        toUndo.push(holder->getUndoNextLSN());
+    }
+    
+    else if (record->getType() == TxType::UPDATE){
+        /* if update, undo */
+        UpdateLogRecord* update_log = dynamic_cast<UpdateLogRecord*>(record);
+        prefetchFor(update_log->getPageID());
+        LSN lsn = se->nextLSN();
+        
+        /* 1. write an CLR to log
+          update Tx Table */
+        CompensationLogRecord* new_log = new CompensationLogRecord(lsn,
+                                                                   getLastLSN(update_log->getTxID()),
+                                                                   update_log->getTxID(),
+                                                                   update_log->getPageID(),
+                                                                   update_log->getOffset(),
+                                                                   update_log->getBeforeImage(),
+                                                                   update_log->getprevLSN());
         
-        while ( idx >= 0 && log[idx]->getLSN() != lsn_now) {idx--;}
-        if (idx < 0) {
-            return; // should not reach here
+        appendLog(new_log);
+        setLastLSN(update_log->getTxID(), lsn);
+        /* the page may have been written back since the update; the
+           CLR dirties it again, and redo must not skip it */
+        if (dirty_page_table.find(update_log->getPageID()) == dirty_page_table.end()) {
+            dirty_page_table[update_log->getPageID()] = lsn;
         }
         
-        if (log[idx]->getType() == TxType::CLR) {
-            /* if this is a CLR */
-            CompensationLogRecord* holder = dynamic_cast<CompensationLogRecord*>(log[idx]);
-            if (holder->getUndoNextLSN() == NULL_LSN) {
-                /* write an end for this Tx */
-                logtail.push_back(new LogRecord(se->nextLSN(), getLastLSN(holder->getTxID()), holder->getTxID(), TxType::END));
-                tx_table.erase(holder->getTxID());
-                continue;
-            }
-            toUndo.push(holder->getUndoNextLSN());
+        /* 2. undo */
+        if (se->pageWrite(update_log->getPageID(), update_log->getOffset(), update_log->getBeforeImage(), lsn) == false) {
+            return false;
         }
         
-        else if (log[idx]->getType() == TxType::UPDATE){
-            /* if update, undo */
-            UpdateLogRecord* update_log = dynamic_cast<UpdateLogRecord*>(log[idx]);
-            int lsn = se->nextLSN();
-            
-            /* 1. write an CLR to log
-              update Tx Table */
+        /* 3. if end record for this Tx */
+        if (update_log->getprevLSN() == NULL_LSN) {
+            /* write an end record for this transaction, take it off TxTable */
+            appendLog(new LogRecord(se->nextLSN(), lsn, update_log->getTxID(), TxType::END));
+            tx_table.erase(update_log->getTxID());
+        }
+        else{
+            toUndo.push(update_log->getprevLSN());
+        }
+    }
+    else if (record->getType() == TxType::MULTI_UPDATE){
+        /* undo the extents back to front, one CLR each */
+        MultiUpdateLogRecord* multi_log = dynamic_cast<MultiUpdateLogRecord*>(record);
+        const vector<UpdateExtent>& extents = multi_log->getExtents();
+        prefetchFor(multi_log->getPageID());
+        LSN lsn = NULL_LSN;
+        
+        for (int i = (int)extents.size() - 1; i >= 0; i--) {
+            lsn = se->nextLSN();
+            /* only the last CLR may skip past this record; if we crash
+               before that, the whole record is undone again */
+            LSN undo_next = (i == 0) ? multi_log->getprevLSN() : multi_log->getLSN();
             CompensationLogRecord* new_log = new CompensationLogRecord(lsn,
-                                                                       getLastLSN(update_log->getTxID()),
-                                                                       update_log->getTxID(),
-                                                                       update_log->getPageID(),
-                                                                       update_log->getOffset(),
-                                                                       update_log->getBeforeImage(),
-                                                                       update_log->getprevLSN());
-            
-            logtail.push_back(new_log);
-            setLastLSN(update_log->getTxID(), lsn);
-            
-            /* 2. undo */
-            if (se->pageWrite(update_log->getPageID(), update_log->getOffset(), update_log->getBeforeImage(), lsn) == false) {
-                return;
+                                                                       getLastLSN(multi_log->getTxID()),
+                                                                       multi_log->getTxID(),
+                                                                       multi_log->getPageID(),
+                                                                       extents[i].offset,
+                                                                       extents[i].beforeImage,
+                                                                       undo_next);
+            appendLog(new_log);
+            setLastLSN(multi_log->getTxID(), lsn);
+            if (dirty_page_table.find(multi_log->getPageID()) == dirty_page_table.end()) {
+                dirty_page_table[multi_log->getPageID()] = lsn;
             }
             
-            /* 3. if end record for this Tx */
-            if (update_log->getprevLSN() == NULL_LSN) {
-                /* write an end record for this transaction, take it off TxTable */
-                logtail.push_back(new LogRecord(se->nextLSN(), lsn, update_log->getTxID(), TxType::END));
-                tx_table.erase(update_log->getTxID());
-            }
-            else{
-                toUndo.push(update_log->getprevLSN());
+            if (se->pageWrite(multi_log->getPageID(), extents[i].offset, extents[i].beforeImage, lsn) == false) {
+                return false;
             }
         }
-        else if(log[idx]->getType() == TxType::ABORT){
-            if (log[idx]->getprevLSN() == NULL_LSN) {
-                /* write an end to the abort Tx */
-                logtail.push_back(new LogRecord(se->nextLSN(), log[idx]->getLSN(), log[idx]->getTxID(), TxType::END));
-                tx_table.erase(log[idx]->getTxID());
-            }
-            else{
-                toUndo.push(log[idx]->getprevLSN());
-            }
+        
+        if (multi_log->getprevLSN() == NULL_LSN) {
+            appendLog(new LogRecord(se->nextLSN(), lsn, multi_log->getTxID(), TxType::END));
+            tx_table.erase(multi_log->getTxID());
+        }
+        else{
+            toUndo.push(multi_log->getprevLSN());
+        }
+    }
+    else if(record->getType() == TxType::ABORT){
+        if (record->getprevLSN() == NULL_LSN) {
+            /* write an end to the abort Tx */
+            appendLog(new LogRecord(se->nextLSN(), record->getLSN(), record->getTxID(), TxType::END));
+            tx_table.erase(record->getTxID());
         }
         else{
-            /* no need to do anything */
+            toUndo.push(record->getprevLSN());
         }
-    }// end: while
+    }
+    else{
+        /* no need to do anything */
+    }
+    return true;
 }
 
 
@@ -311,91 +820,730 @@ void LogMgr::undo(vector <LogRecord*> log, int txnum){
  * Abort the specified transaction.
  * Hint: you can use your undo function
  */
-void LogMgr::abort(int txid){
+template <class Engine>
+void BasicLogMgr<Engine>::abort(int txid){
+    lock_guard<recursive_mutex> guard(se->getLatch());
     /* write an abort */
-    int lsn = se->nextLSN();
-    logtail.push_back(new LogRecord(lsn, getLastLSN(txid), txid, TxType::ABORT));
+    LSN lsn = se->nextLSN();
+    appendLog(new LogRecord(lsn, getLastLSN(txid), txid, TxType::ABORT));
     setLastLSN(txid, lsn);
     
-    vector<LogRecord*> logs = LogMgr::stringToLRVector(se->getLog());
-    for (int i = 0; i < logtail.size(); i++) {
-        logs.push_back(logtail[i]);
+    /* call undo; it reads each record of txid where its LSN points, in
+       the log on disk or the log tail */
+    undo(se->getLog(), txid);
+    if (tx_table.find(txid) == tx_table.end()) {
+        endSnapshot(txid, false, NULL_LSN);
     }
-    /* call undo  */
-    undo(logs, txid);
+    afterLog();
+    se->getLockMgr()->releaseAll(txid);
 }
 
 /*
  * Write the begin checkpoint and end checkpoint
  */
-void LogMgr::checkpoint(){
+template <class Engine>
+void BasicLogMgr<Engine>::checkpoint(){
+    lock_guard<recursive_mutex> guard(se->getLatch());
+    /* recovery left in the background is finished first */
+    finishRecovery();
+    takeCheckpoint(false);
+}
+
+template <class Engine>
+void BasicLogMgr<Engine>::takeCheckpoint(bool full){
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (options.checkpoint_write_back) {
+        se->writeBackAll();
+    }
     /* write a begin checkpoint message */
-    int lsn_now = se->nextLSN();
-    int lsn_prev = NULL_LSN;
-    logtail.push_back(new LogRecord(lsn_now, lsn_prev, NULL_TX, TxType::BEGIN_CKPT));
+    LSN lsn_now = se->nextLSN();
+    LSN lsn_prev = NULL_LSN;
+    appendLog(new LogRecord(lsn_now, lsn_prev, NULL_TX, TxType::BEGIN_CKPT));
     lsn_prev = lsn_now;
     lsn_now = se->nextLSN();
-    /* write a end checkpoint */
-    logtail.push_back(new ChkptLogRecord(lsn_now, lsn_prev, NULL_TX, tx_table, dirty_page_table));
+    /* write a end checkpoint, only what changed since the last one if
+       that is allowed */
+    full = full || !options.delta_checkpoints || last_checkpoint_lsn == NULL_LSN ||
+        deltas_since_full >= options.checkpoint_full_every;
+    LogRecord* end_ckpt;
+    if (full) {
+        end_ckpt = new ChkptLogRecord(lsn_now, lsn_prev, NULL_TX, tx_table, dirty_page_table);
+        deltas_since_full = 0;
+    }
+    else {
+        map <int, txTableEntry> tx_changes;
+        map <int, LSN> dpt_changes;
+        vector <int> removed_txs, removed_pages;
+        for (auto it = tx_table.begin(); it != tx_table.end(); ++it) {
+            auto old = ckpt_tx_table.find(it->first);
+            if (old == ckpt_tx_table.end() || old->second.lastLSN != it->second.lastLSN ||
+                old->second.status != it->second.status) {
+                tx_changes[it->first] = it->second;
+            }
+        }
+        for (auto it = ckpt_tx_table.begin(); it != ckpt_tx_table.end(); ++it) {
+            if (tx_table.find(it->first) == tx_table.end()) {
+                removed_txs.push_back(it->first);
+            }
+        }
+        for (auto it = dirty_page_table.begin(); it != dirty_page_table.end(); ++it) {
+            auto old = ckpt_dirty_page_table.find(it->first);
+            if (old == ckpt_dirty_page_table.end() || old->second != it->second) {
+                dpt_changes[it->first] = it->second;
+            }
+        }
+        for (auto it = ckpt_dirty_page_table.begin(); it != ckpt_dirty_page_table.end(); ++it) {
+            if (dirty_page_table.find(it->first) == dirty_page_table.end()) {
+                removed_pages.push_back(it->first);
+            }
+        }
+        end_ckpt = new DeltaChkptLogRecord(lsn_now, lsn_prev, last_checkpoint_lsn,
+                                           tx_changes, dpt_changes, removed_txs, removed_pages);
+        deltas_since_full++;
+    }
+    appendLog(end_ckpt);
+    size_t ckpt_bytes = se->nextLSN() - lsn_now;
 
     /* write end checkpoint to stable storage */
     se->store_master(lsn_now);
     flushLogTail(lsn_now);
+    ckpt_tx_table = tx_table;
+    ckpt_dirty_page_table = dirty_page_table;
+    last_checkpoint_lsn = lsn_now;
+    bytes_since_checkpoint = 0;
+    dpt_pages_at_checkpoint = dirty_page_table.size();
+    imaged_pages.clear();
+    metrics.add("checkpoints", 1);
+    metrics.add(full ? "checkpoints_full" : "checkpoints_delta", 1);
+    metrics.set("checkpoint_bytes", ckpt_bytes);
+    metrics.add("checkpoint_bytes_total", ckpt_bytes);
+    metrics.set("checkpoint_us", chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
 }
 
 /* force-write a commit
  * Commit the specified transaction.
  */
-void LogMgr::commit(int txid){
+template <class Engine>
+void BasicLogMgr<Engine>::commit(int txid){
+    commit(txid, options.async_commit);
+}
+
+/*
+ * Commit the specified transaction, either forcing the log (sync) or
+ * leaving the commit record in the tail for the log writer (async).
+ */
+template <class Engine>
+void BasicLogMgr<Engine>::commit(int txid, bool async, DurableCallback on_durable){
+    lock_guard<recursive_mutex> guard(se->getLatch());
     /* write a commit log */
-    int lsn_now = se->nextLSN();
-    logtail.push_back(new LogRecord(lsn_now, getLastLSN(txid), txid, TxType::COMMIT));
+    LSN lsn_now = se->nextLSN();
+    appendLog(new LogRecord(lsn_now, getLastLSN(txid), txid, TxType::COMMIT));
     
-    flushLogTail(lsn_now);
+    if (async) {
+        pending_commits.push_back(PendingCommit(txid, lsn_now, on_durable));
+    }
+    else{
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        flushLogTail(lsn_now);
+        double us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        metrics.add("commit_force_us_total", us);
+        metrics.set("commit_force_us_max", max(metrics.get("commit_force_us_max"), us));
+        if (on_durable) {
+            on_durable(txid, lsn_now);
+        }
+    }
     tx_table.erase(txid);
+    endSnapshot(txid, true, lsn_now);
     
     /* write an end record after flush */
-    logtail.push_back(new LogRecord(se->nextLSN(), lsn_now, txid, TxType::END));
-
+    appendLog(new LogRecord(se->nextLSN(), lsn_now, txid, TxType::END));
+    afterLog();
+    /* strict two-phase locking: locks go once the outcome is logged */
+    se->getLockMgr()->releaseAll(txid);
 }
 
 /*
  * A function that StorageEngine will call when it's about to
- * write a page to disk.
+ * write a batch of pages to disk.
  * Remember, you need to implement write-ahead logging
  */
-void LogMgr::pageFlushed(int page_id){
+template <class Engine>
+void BasicLogMgr<Engine>::pagesFlushed(LSN flush_lsn){
     
-    /* log first */
-    flushLogTail(se->getLSN(page_id));
-    dirty_page_table.erase(page_id);
+    /* log first, once for the whole batch */
+    flushLogTail(flush_lsn);
+    return;
+}
+
+/*
+ * A page that did not reach the disk keeps its dirty page table entry,
+ * so redo still starts early enough for it.
+ */
+template <class Engine>
+void BasicLogMgr<Engine>::pagesWritten(const vector<int>& page_ids){
+    for (unsigned i = 0; i < page_ids.size(); i++) {
+        dirty_page_table.erase(page_ids[i]);
+        if (options.log_page_flushes) {
+            /* no need to force it: if it is lost, analysis only keeps
+               the page in the table as before */
+            appendLog(new PageFlushLogRecord(se->nextLSN(), page_ids[i], se->getLSN(page_ids[i])));
+            metrics.add("page_flush_records", 1);
+        }
+    }
     return;
 }
 
 /*
  * Recover from a crash, given the log from the disk.
  */
-void LogMgr::recover(string log){
-    /* 1. get log */
-    vector<LogRecord*> logs = stringToLRVector(log);
-    analyze(logs);
-    if (redo(logs) == false) {
+template <class Engine>
+void BasicLogMgr<Engine>::recover(string log){
+    /* 1. analysis parses the log from the last checkpoint on */
+    metrics.set("recovery_done", 0);
+    vector<LogRecord*> logs = analyze(log);
+    /* redo may have to start further back, at the oldest recLSN */
+    LSN redo_start = redoStartLSN();
+    if (!logs.empty() && redo_start != NULL_LSN && redo_start < logs[0]->getLSN()) {
+        vector<LogRecord*> older = stringToLRVector(log, redo_start - se->getLogStart(),
+                                                    logs[0]->getLSN() - se->getLogStart());
+        logs.insert(logs.begin(), older.begin(), older.end());
+    }
+    metrics.set("recovery_log_records", logs.size());
+    if (options.restartable_recovery) {
+        /* the next crash's analysis starts here */
+        checkpoint();
+        metrics.add("recovery_checkpoints", 1);
+    }
+    
+    if (options.instant_restart) {
+        /* hand each page its share of redo; pages are brought up to
+           date as they are loaded, undo included */
+        planRedo(logs);
+        endCommitted();
+    }
+    else{
+        /* time redo so the checkpoint scheduler can use the real cost
+           of a byte redo reads, from redo_start to the end of the log */
+        long long redo_bytes = (redo_start == NULL_LSN) ? 0 :
+            se->getLogStart() + (LSN)log.size() - redo_start;
+        chrono::steady_clock::time_point redo_began = chrono::steady_clock::now();
+        bool redo_done = redo(logs);
+        double redo_us = chrono::duration<double, micro>(chrono::steady_clock::now() - redo_began).count();
+        metrics.set("recovery_redo_ms", redo_us / 1000.0);
+        if (redo_bytes > 0) {
+            measured_us_per_byte = redo_us / redo_bytes;
+        }
+        if (redo_done == false) {
+            for (int i = 0; i < logs.size(); i++) {
+                delete logs[i];
+            }
+            return;
+        }
+        if (options.restartable_recovery) {
+            /* with the redone pages on disk and out of the dirty page
+               table, the next crash has nothing left to redo; pages
+               that were not in the buffer are up to date on disk */
+            if (se->flushAll()) {
+                dirty_page_table.clear();
+                checkpoint();
+                metrics.add("recovery_checkpoints", 1);
+            }
+        }
+    }
+    
+    if (options.background_undo) {
+        startBackgroundUndo(log);
+    }
+    else{
+        if (options.recovery_prefetch) {
+            priority_queue<LSN> losers;
+            for (auto it = tx_table.begin(); it != tx_table.end(); ++it) {
+                if (it->second.lastLSN != NULL_LSN && it->second.status == TxStatus::U) {
+                    losers.push(it->second.lastLSN);
+                }
+            }
+            map<int, int> uses;
+            vector<int> order = undoPages(log, losers, &uses);
+            startPrefetch(order, uses);
+        }
+        undo(log);
+        startPrefetch(vector<int>());
+        bool losers_left = false;
+        for (auto it = tx_table.begin(); it != tx_table.end(); ++it) {
+            losers_left = losers_left || it->second.status == TxStatus::U;
+        }
+        metrics.set("recovery_done", losers_left ? 0 : 1);
+    }
+    if (options.instant_restart) {
+        metrics.set("restart_pages_pending", pending_redo.size());
+    }
+    if (!pending_redo.empty() || !undo_queue.empty()) {
+        recovery_log = logs;
+        recovery_text = move(log);
+    }
+    else{
+        for (int i = 0; i < logs.size(); i++) {
+            delete logs[i];
+        }
+    }
+}
+
+template <class Engine>
+void BasicLogMgr<Engine>::pageLoaded(int page_id){
+    auto pending = pending_redo.find(page_id);
+    if (pending == pending_redo.end()) {
+        return;
+    }
+    vector<LogRecord*> records = pending->second;
+    pending_redo.erase(pending);
+    
+    for (int i = 0; i < records.size(); i++) {
+        if (records[i]->getType() == TxType::PAGE_IMAGE ||
+            se->getLSN(page_id) < records[i]->getLSN()) {
+            redoRecord(records[i]);
+        }
+    }
+    metrics.add("restart_pages_redone", 1);
+}
+
+/*
+ * Loading a page is what redoes it, so the background task only has
+ * to load pages no one has asked for yet. The recovery log is freed
+ * here rather than in pageLoaded: a page can be loaded in the middle
+ * of an undo step, when undo_queue is empty only for the moment.
+ */
+template <class Engine>
+void BasicLogMgr<Engine>::backgroundRedo(int pages){
+    for (int n = 0; n < pages && !pending_redo.empty(); n++) {
+        se->getLSN(pending_redo.begin()->first);
+    }
+    releaseRecoveryLog();
+}
+
+template <class Engine>
+void BasicLogMgr<Engine>::startBackgroundUndo(const string& log){
+    for (auto it = tx_table.begin(); it != tx_table.end(); ++it) {
+        if (it->second.lastLSN != NULL_LSN && it->second.status == TxStatus::U) {
+            undo_queue.push(it->second.lastLSN);
+            /* pages an earlier CLR restored are not on the chain */
+            priority_queue<LSN> chain;
+            chain.push(it->second.lastLSN);
+            vector<int> pages = undoPages(log, chain);
+            loser_pages[it->first].insert(pages.begin(), pages.end());
+        }
+    }
+    metrics.set("undo_losers_total", loser_pages.size());
+    metrics.set("undo_losers_remaining", loser_pages.size());
+}
+
+/*
+ * Runs after recovery has returned, so its page writes do not count
+ * against the crash's page write budget.
+ */
+template <class Engine>
+void BasicLogMgr<Engine>::backgroundUndo(int steps){
+    if (undo_queue.empty()) {
+        return;
+    }
+    se->setRepairing(true);
+    bool failed = false;
+    for (int n = 0; n < steps && !undo_queue.empty(); n++) {
+        if (undoNext(recovery_text, undo_queue) == false) {
+            undo_queue = priority_queue<LSN>();
+            failed = true;
+        }
+        metrics.add("undo_records_processed", 1);
+    }
+    se->setRepairing(false);
+    if (undo_queue.empty() && !failed) {
+        metrics.set("recovery_done", 1);
+    }
+    
+    /* a loser that got its end record is rolled back */
+    auto loser = loser_pages.begin();
+    while (loser != loser_pages.end()) {
+        if (undo_queue.empty() || tx_table.find(loser->first) == tx_table.end()) {
+            loser = loser_pages.erase(loser);
+        }
+        else{
+            ++loser;
+        }
+    }
+    set<int> locked;
+    for (loser = loser_pages.begin(); loser != loser_pages.end(); ++loser) {
+        locked.insert(loser->second.begin(), loser->second.end());
+    }
+    metrics.set("undo_losers_remaining", loser_pages.size());
+    metrics.set("undo_pages_locked", locked.size());
+    metrics.set("undo_lsns_queued", undo_queue.size());
+    releaseRecoveryLog();
+}
+
+template <class Engine>
+void BasicLogMgr<Engine>::finishRecovery(){
+    lock_guard<recursive_mutex> guard(se->getLatch());
+    backgroundRedo(INT_MAX);
+    backgroundUndo(INT_MAX);
+}
+
+template <class Engine>
+void BasicLogMgr<Engine>::releaseRecoveryLog(){
+    if (!pending_redo.empty() || !undo_queue.empty()) {
+        return;
+    }
+    for (int i = 0; i < recovery_log.size(); i++) {
+        delete recovery_log[i];
+    }
+    recovery_log.clear();
+    recovery_text.clear();
+}
+
+template <class Engine>
+void BasicLogMgr<Engine>::lockPage(int txid, int page_id){
+    if (loser_pages.find(txid) != loser_pages.end()) {
+        return;
+    }
+    bool waited = false;
+    while (!undo_queue.empty()) {
+        bool locked = false;
+        for (auto loser = loser_pages.begin(); loser != loser_pages.end(); ++loser) {
+            locked = locked || loser->second.count(page_id);
+        }
+        if (!locked) {
+            break;
+        }
+        backgroundUndo(1);
+        waited = true;
+    }
+    if (waited) {
+        metrics.add("undo_lock_waits", 1);
+    }
+}
+
+/*
+ * Versions of one page are kept in LSN order, so the newest is last.
+ */
+template <class Engine>
+void BasicLogMgr<Engine>::addVersion(int txid, int page_id, LSN lsn, int offset, const string& before){
+    if (!options.snapshot_reads) {
+        return;
+    }
+    versions[page_id].push_back(PageVersion(lsn, txid, offset, before));
+    version_counts[txid]++;
+    version_bytes += before.size();
+    metrics.set("version_chain_bytes", version_bytes);
+    if (version_bytes > options.version_chain_bytes) {
+        collectVersions();
+    }
+}
+
+/*
+ * A version matters only to snapshots that cannot see it: every
+ * snapshot while its transaction is uncommitted, and those taken
+ * before the commit afterwards. Snapshots taken from now on see every
+ * committed change, so only the oldest live snapshot decides.
+ */
+template <class Engine>
+void BasicLogMgr<Engine>::collectVersions(){
+    while (true) {
+        LSN oldest_snapshot = INT64_MAX;
+        for (auto it = snapshots.begin(); it != snapshots.end(); ++it) {
+            oldest_snapshot = min(oldest_snapshot, it->second);
+        }
+        for (auto page = versions.begin(); page != versions.end(); ) {
+            vector <PageVersion>& chain = page->second;
+            unsigned kept = 0;
+            for (unsigned i = 0; i < chain.size(); i++) {
+                auto commit = commit_lsns.find(chain[i].txid);
+                bool aborted = version_counts.find(chain[i].txid) == version_counts.end();
+                if (aborted || (commit != commit_lsns.end() && commit->second < oldest_snapshot)) {
+                    version_bytes -= chain[i].beforeImage.size();
+                    if (!aborted && --version_counts[chain[i].txid] == 0) {
+                        version_counts.erase(chain[i].txid);
+                        commit_lsns.erase(chain[i].txid);
+                    }
+                    metrics.add("versions_collected", 1);
+                }
+                else {
+                    if (kept != i) {
+                        chain[kept] = move(chain[i]);
+                    }
+                    kept++;
+                }
+            }
+            chain.erase(chain.begin() + kept, chain.end());
+            page = chain.empty() ? versions.erase(page) : next(page);
+        }
+        if (version_bytes <= options.version_chain_bytes || snapshots.empty()) {
+            break;
+        }
+        /* still over: the oldest snapshot has to go, but only if that
+           frees something; with it (and any taken at the same LSN)
+           gone, the next oldest decides */
+        LSN next_snapshot = INT64_MAX;
+        for (auto it = snapshots.begin(); it != snapshots.end(); ++it) {
+            if (it->second > oldest_snapshot) {
+                next_snapshot = min(next_snapshot, it->second);
+            }
+        }
+        long long freed = 0;
+        for (auto page = versions.begin(); page != versions.end(); ++page) {
+            for (unsigned i = 0; i < page->second.size(); i++) {
+                auto commit = commit_lsns.find(page->second[i].txid);
+                if (commit != commit_lsns.end() && commit->second < next_snapshot) {
+                    freed += page->second[i].beforeImage.size();
+                }
+            }
+        }
+        if (freed == 0) {
+            break;
+        }
+        for (auto it = snapshots.begin(); it != snapshots.end(); ++it) {
+            if (it->second == oldest_snapshot) {
+                stale_snapshots.insert(it->first);
+                snapshots.erase(it);
+                metrics.add("snapshots_too_old", 1);
+                break;
+            }
+        }
+    }
+    /* what is left is uncommitted, or dropping the oldest snapshot
+       would not free it */
+    if (version_bytes > options.version_chain_bytes) {
+        metrics.add("version_chain_over_budget", 1);
+    }
+    metrics.set("version_chain_bytes", version_bytes);
+}
+
+template <class Engine>
+void BasicLogMgr<Engine>::endSnapshot(int txid, bool committed, LSN commit_lsn){
+    snapshots.erase(txid);
+    stale_snapshots.erase(txid);
+    if (version_counts.find(txid) != version_counts.end()) {
+        if (committed) {
+            commit_lsns[txid] = commit_lsn;
+        }
+        else {
+            /* rolled back: the page has the before images again, and
+               collectVersions drops what has no count */
+            version_counts.erase(txid);
+        }
+    }
+    if (!versions.empty()) {
+        collectVersions();
+    }
+}
+
+/*
+ * Walks the page's versions from the newest back. A byte keeps the
+ * value it has now until the walk passes a version the snapshot cannot
+ * see that covers it, which takes the byte back to that version's
+ * before image; the first version it can see covering the byte ends
+ * the walk for that byte.
+ */
+template <class Engine>
+bool BasicLogMgr<Engine>::snapshotRead(int txid, int page_id, int offset, string& data){
+    if (!options.snapshot_reads) {
+        /* no versions were kept, so the buffer may hold anything */
+        return false;
+    }
+    metrics.add("snapshot_reads", 1);
+    if (stale_snapshots.count(txid)) {
+        return false;
+    }
+    if (snapshots.find(txid) == snapshots.end()) {
+        /* sees everything logged before the log's current end */
+        snapshots[txid] = se->nextLSN();
+    }
+    LSN snapshot = snapshots[txid];
+    auto page = versions.find(page_id);
+    if (page == versions.end()) {
+        return true;
+    }
+    vector <PageVersion>& chain = page->second;
+    vector <bool> settled(data.size(), false);
+    for (int i = (int)chain.size() - 1; i >= 0; i--) {
+        const PageVersion& version = chain[i];
+        auto commit = commit_lsns.find(version.txid);
+        bool visible = version.txid == txid ||
+            (commit != commit_lsns.end() && commit->second < snapshot);
+        int from = max(offset, version.offset);
+        int to = min(offset + (int)data.size(), version.offset + (int)version.beforeImage.size());
+        for (int b = from; b < to; b++) {
+            if (settled[b - offset]) {
+                continue;
+            }
+            if (visible) {
+                settled[b - offset] = true;
+            }
+            else {
+                data[b - offset] = version.beforeImage[b - version.offset];
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Standby apply. Unlike redo there is no dirty page table to consult:
+ * the standby's pages are live, so the page LSN alone decides.
+ */
+template <class Engine>
+void BasicLogMgr<Engine>::replayRecord(LogRecord* record){
+    LSN lsn_now = record->getLSN();
+    TxType type = record->getType();
+    if (type == TxType::END_CKPT || type == TxType::DELTA_CKPT) {
+        se->store_master(lsn_now);
+    }
+    else if (type != TxType::BEGIN_CKPT) {
+        analyzeRecord(record);
+    }
+    
+    int page_id = pageOf(record);
+    if (page_id != -1 && se->getLSN(page_id) < lsn_now) {
+        redoRecord(record);
+        metrics.add("standby_pages_redone", 1);
+    }
+    metrics.add("standby_records_applied", 1);
+    delete record;
+}
+
+template <class Engine>
+void BasicLogMgr<Engine>::promote(){
+    endCommitted();
+    /* the standby's log is the primary's byte for byte, so undo reads
+       the records it needs from it */
+    undo(se->getLog());
+    metrics.add("standby_promotions", 1);
+}
+
+/*
+ * The backup starts with a checkpoint and then copies the pages on
+ * disk. Pages still dirty in the buffer are copied as last written, so
+ * restore has to redo from the oldest recLSN in that checkpoint's dirty
+ * page table, and read the log from the first record of any transaction
+ * in flight so it can undo it.
+ */
+template <class Engine>
+bool BasicLogMgr<Engine>::backup(string path){
+    lock_guard<recursive_mutex> guard(se->getLatch());
+    /* full, so restore does not need the log before the backup */
+    takeCheckpoint(true);
+    BackupInfo info;
+    info.checkpoint_lsn = se->get_master();
+    info.redo_lsn = info.checkpoint_lsn;
+    for (auto it = dirty_page_table.begin(); it != dirty_page_table.end(); ++it) {
+        info.redo_lsn = min(info.redo_lsn, it->second);
+    }
+    
+    LSN first_lsn = info.redo_lsn;
+    bool in_flight = false;
+    for (auto it = tx_table.begin(); it != tx_table.end(); ++it) {
+        in_flight = in_flight || it->second.status == TxStatus::U;
+    }
+    if (in_flight) {
+        /* first LSN of every transaction that has not ended: follow its
+           prevLSNs back from its last record */
+        string log = se->getLog();
+        for (auto it = tx_table.begin(); it != tx_table.end(); ++it) {
+            LSN lsn = it->second.status == TxStatus::U ? it->second.lastLSN : NULL_LSN;
+            while (lsn != NULL_LSN) {
+                unique_ptr<LogRecord> parsed;
+                LogRecord* record = readRecord(log, lsn, parsed);
+                if (record == nullptr) {
+                    break;
+                }
+                first_lsn = min(first_lsn, lsn);
+                lsn = record->getprevLSN();
+            }
+        }
+    }
+    
+    /* the first record restore needs */
+    info.log_offset = first_lsn;
+    info.time_ms = chrono::duration_cast<chrono::milliseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+    
+    bool ok = se->backup(path, info);
+    if (ok) {
+        metrics.add("backups", 1);
+    }
+    return ok;
+}
+
+template <class Engine>
+bool BasicLogMgr<Engine>::restore(string log, BackupInfo info, LSN target_lsn){
+    if (target_lsn < info.checkpoint_lsn) {
+        return false;
+    }
+    
+    /* drop everything after the record target_lsn falls in, which the
+       LSN locates in log as an offset from info.log_offset */
+    if (target_lsn - info.log_offset < (LSN)log.size()) {
+        size_t nl = log.find('\n', target_lsn - info.log_offset);
+        log.resize(nl == string::npos ? log.size() : nl + 1);
+    }
+    
+    /* the restored database's log begins with what was replayed, at
+       the LSNs it had */
+    se->setLogStart(info.log_offset);
+    se->updateLog(log);
+    se->observeLog(info.log_offset + log.size());
+    se->store_master(info.checkpoint_lsn);
+    
+    /* the same analysis, redo and undo as crash recovery, without a
+       limit on page writes */
+    se->permitPageWrites(INT_MAX);
+    recover(log);
+    se->end_crash(this);
+    metrics.add("restore_log_bytes", log.size());
+    return true;
+}
+
+/*
+ * Logs a full page image ahead of the first update to a page since the
+ * last checkpoint. The image is taken before that update is applied.
+ */
+template <class Engine>
+void BasicLogMgr<Engine>::logPageImage(int page_id){
+    if (!options.full_page_images || imaged_pages.count(page_id)) {
         return;
     }
-    undo(logs);
+    string image;
+    if (!se->getPageImage(page_id, image)) {
+        /* no page to take an image of */
+        return;
+    }
+    LSN lsn_now = se->nextLSN();
+    appendLog(new PageImageLogRecord(lsn_now, page_id, image));
+    imaged_pages.insert(page_id);
+    if (dirty_page_table.find(page_id) == dirty_page_table.end()) {
+        dirty_page_table[page_id] = lsn_now;
+    }
+    metrics.add("page_images_logged", 1);
 }
 
 /*
  * Logs an update to the database and updates tables if needed.
  * return the pageLSN that that page should update it's pageLSN to
  */
-int LogMgr::write(int txid, int page_id, int offset, string input, string oldtext){
-    int lsn_now = se->nextLSN();
-    int lsn_prev = getLastLSN(txid);
+template <class Engine>
+LSN BasicLogMgr<Engine>::write(int txid, int page_id, int offset, string_view input, string oldtext){
+    logPageImage(page_id);
+    LSN lsn_now = coalesceWrite(txid, page_id, offset, input, oldtext);
+    if (lsn_now != NULL_LSN) {
+        addVersion(txid, page_id, lsn_now, offset, oldtext);
+        afterLog();
+        return lsn_now;
+    }
+    lsn_now = se->nextLSN();
+    LSN lsn_prev = getLastLSN(txid);
+    addVersion(txid, page_id, lsn_now, offset, oldtext);
 
         /* update log tail */
-    UpdateLogRecord* log_now = new UpdateLogRecord(lsn_now, lsn_prev, txid, page_id, offset, oldtext, input);
-    logtail.push_back(log_now);
+    UpdateLogRecord* log_now = new UpdateLogRecord(lsn_now, lsn_prev, txid, page_id, offset,
+                                                  move(oldtext), string(input));
+    appendLog(log_now);
     setLastLSN(txid, lsn_now);
     
     /* update tx table */
@@ -407,14 +1555,88 @@ int LogMgr::write(int txid, int page_id, int offset, string input, string oldtex
         dirty_page_table[page_id] = lsn_now;
     }
     
+    afterLog();
     return lsn_now;
 }
 
+/*
+ * The record keeps its LSN, which is already the page's pageLSN, so the
+ * tables need no change. It cannot be on disk yet (it is in the tail),
+ * so the page cannot have been written back with only part of it.
+ */
+template <class Engine>
+LSN BasicLogMgr<Engine>::coalesceWrite(int txid, int page_id, int offset, string_view input, const string& oldtext){
+    if (!options.coalesce_writes || logtail.empty() || logtail.back()->getType() != TxType::UPDATE) {
+        return NULL_LSN;
+    }
+    UpdateLogRecord* last = dynamic_cast<UpdateLogRecord*>(logtail.back());
+    if (last->getTxID() != txid || last->getPageID() != page_id) {
+        return NULL_LSN;
+    }
+    size_t last_start = last->getLSN() - logtail.front()->getLSN();
+    size_t last_bytes = tail_text.size() - last_start;
+    /* the record this update would have had on its own differs from
+       the last one only in its LSNs, offset and images */
+    size_t own_bytes = last_bytes + to_string(se->nextLSN()).size() + to_string(offset).size() +
+        oldtext.size() + input.size() - to_string(last->getprevLSN()).size() -
+        to_string(last->getOffset()).size() - last->getBeforeImage().size() - last->getAfterImage().size();
+    string after(input);
+    if (!last->coalesce(offset, oldtext, after)) {
+        return NULL_LSN;
+    }
+    /* nothing follows it, so only the log's end moves */
+    tail_text.resize(last_start);
+    last->appendTo(tail_text);
+    size_t bytes = tail_text.size() - last_start;
+    se->extendLog((long long)bytes - (long long)last_bytes);
+    metrics.add("coalesced_records", 1);
+    metrics.add("coalesced_bytes_saved", (double)(last_bytes + own_bytes) - bytes);
+    return last->getLSN();
+}
+
+/*
+ * Logs a batch of updates to one page as a single multi-extent record.
+ * return the pageLSN that that page should update it's pageLSN to
+ */
+template <class Engine>
+LSN BasicLogMgr<Engine>::writeExtents(int txid, int page_id, vector<UpdateExtent> extents){
+    logPageImage(page_id);
+    LSN lsn_now = se->nextLSN();
+    LSN lsn_prev = getLastLSN(txid);
+    for (unsigned i = 0; i < extents.size(); i++) {
+        addVersion(txid, page_id, lsn_now, extents[i].offset, extents[i].beforeImage);
+    }
+    
+    appendLog(new MultiUpdateLogRecord(lsn_now, lsn_prev, txid, page_id, move(extents)));
+    
+    /* update tx table */
+    tx_table[txid].lastLSN = lsn_now;
+    tx_table[txid].status = TxStatus::U;
+    
+    /* update dirty page table */
+    if (dirty_page_table.find(page_id) == dirty_page_table.end()) {
+        dirty_page_table[page_id] = lsn_now;
+    }
+    
+    afterLog();
+    return lsn_now;
+}
 
 
-void LogMgr::setStorageEngine(StorageEngine* engine){
+template <class Engine>
+void BasicLogMgr<Engine>::setStorageEngine(Engine* engine){
     /*
      * Sets this.se to engine.
      */
     se = engine;
-}
\ No newline at end of file
+}
+
+template <class Engine>
+void BasicLogMgr<Engine>::setOptions(LogMgrOptions new_options){
+    options = new_options;
+}
+
+template class BasicLogMgr<StorageEngine>;
+template class BasicLogMgr<MemoryStorageEngine>;
+template class BasicLogMgr<FileStorageEngine>;
+template class BasicLogMgr<DirectStorageEngine>;
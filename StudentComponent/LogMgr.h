@@ -2,53 +2,381 @@
 #define LOGMGR_H_
 
 #include "LogRecord.h"
+#include "Metrics.h"
 #include <vector>
+#include <functional>
+#include <set>
+#include <queue>
+#include <string_view>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <condition_variable>
 #include "../StorageEngine/StorageEngine.h"
 
 using namespace std;
 
 
-const int NULL_LSN = -1;
+const LSN NULL_LSN = -1;
 const int NULL_TX = -1;
 
+/*
+ * Optional LogMgr behaviour. The harness keeps one copy and hands it
+ * to every LogMgr it creates, so settings survive a crash.
+ */
+struct LogMgrOptions {
+  /* commit returns without forcing the log */
+  bool async_commit;
+  /* most log bytes an async commit may trail the log tail before it is
+     forced */
+  int max_commit_lag;
+
+  /* let the checkpoint scheduler take checkpoints on its own */
+  bool auto_checkpoint;
+  /* checkpoint once this many log bytes were written since the last one */
+  long long checkpoint_log_bytes;
+  /* ... or once this many pages were added to the dirty page table */
+  int checkpoint_dpt_pages;
+  /* ... or once the estimated redo time passes this target */
+  double recovery_target_ms;
+  /* never checkpoint for the last two reasons with less log than this
+     since the last checkpoint; another checkpoint would not help redo */
+  long long checkpoint_min_log_bytes;
+  /* log a full page image the first time a page is dirtied after
+     each checkpoint, so redo can start each page from its image */
+  bool full_page_images;
+  /* log a page_flush record whenever a page is written back, so
+     analysis can drop it from the dirty page table */
+  bool log_page_flushes;
+  /* logs at least this big are parsed on parse_threads threads
+     (0 means one per hardware thread) */
+  long long parallel_parse_bytes;
+  unsigned parse_threads;
+  /* redo cost model, used until a recovery has been timed */
+  double redo_us_per_byte;
+  double redo_us_per_page;
+  /* after analysis, redo each page when it is first loaded instead of
+     scanning the log, so new transactions need not wait for redo */
+  bool instant_restart;
+  /* pages the background redo finishes per logged operation; a
+     checkpoint finishes all that are left */
+  int background_redo_pages;
+  /* roll losers back after recovery returns, keeping their pages
+     locked so new transactions can use everything else */
+  bool background_undo;
+  /* log records the background undo handles per logged operation; a
+     checkpoint handles all that are left */
+  int background_undo_records;
+  /* checkpoint after analysis and (with the redone pages written
+     back) after redo, and force each CLR, so a crash during recovery
+     resumes where the last one stopped */
+  bool restartable_recovery;
+  /* ... and also checkpoint every this many redone pages */
+  int recovery_checkpoint_pages;
+  /* end checkpoints log only the table entries that changed since the
+     previous checkpoint ... */
+  bool delta_checkpoints;
+  /* ... with a full one after every this many deltas, which bounds how
+     many analysis has to read back */
+  int checkpoint_full_every;
+  /* fold an update into the previous record in the log tail when that
+     is an update by the same transaction to an overlapping or adjacent
+     range of the same page */
+  bool coalesce_writes;
+  /* a thread of its own hands the log tail to the disk, without
+     waiting for it, once it holds log_writer_bytes or its oldest
+     record has waited log_writer_interval_ms, so forces find little
+     left to write */
+  bool log_writer;
+  long long log_writer_bytes;
+  double log_writer_interval_ms;
+  /* keep the before image of every write in memory so transactions
+     can read a snapshot of committed data */
+  bool snapshot_reads;
+  /* most bytes of before images kept; past it the oldest snapshot is
+     dropped so more versions can be collected */
+  long long version_chain_bytes;
+  /* once analysis has found the pages redo and undo will need, load
+     them a buffer pool's worth at a time ahead of their first use.
+     The loads are synchronous reads in page id order, done when redo
+     or undo reaches the window; they do not overlap with its work */
+  bool recovery_prefetch;
+  /* write every dirty page in the buffer back, as one batch, when a
+     checkpoint begins, so the dirty page table it logs (and the redo
+     after a crash) is small */
+  bool checkpoint_write_back;
+
+  LogMgrOptions() : async_commit(false), max_commit_lag(512),
+    auto_checkpoint(false), checkpoint_log_bytes(1 << 20), checkpoint_dpt_pages(64),
+    recovery_target_ms(50), checkpoint_min_log_bytes(4096),
+    full_page_images(false), log_page_flushes(false), parallel_parse_bytes(4 << 20), parse_threads(0),
+    redo_us_per_byte(0.05), redo_us_per_page(20),
+    instant_restart(false), background_redo_pages(1),
+    background_undo(false), background_undo_records(1),
+    restartable_recovery(false), recovery_checkpoint_pages(32),
+    delta_checkpoints(false), checkpoint_full_every(8), coalesce_writes(false),
+    log_writer(false), log_writer_bytes(16 << 10), log_writer_interval_ms(5),
+    snapshot_reads(false), version_chain_bytes(1 << 20), recovery_prefetch(false),
+    checkpoint_write_back(false) {}
+};
+
+/* Called with (txid, commit lsn) once an async commit is on disk. */
+typedef function<void(int, LSN)> DurableCallback;
+
+struct PendingCommit {
+  int txid;
+  LSN lsn;
+  DurableCallback on_durable;
+  PendingCommit(int tx, LSN commit_lsn, DurableCallback cb) :
+  txid(tx), lsn(commit_lsn), on_durable(cb) {}
+};
+
+/* What offset of a page held before txid changed it at lsn. */
+struct PageVersion {
+  LSN lsn;
+  int txid;
+  int offset;
+  string beforeImage;
+  PageVersion(LSN version_lsn, int tx, int page_offset, string before) :
+  lsn(version_lsn), txid(tx), offset(page_offset), beforeImage(move(before)) {}
+};
 
 
 ///////////////////  LogMgr  ///////////////////
 
-class LogMgr {
+/*
+ * The LogMgr of an Engine, a BasicStorageEngine. Its calls into the
+ * engine are bound when it is compiled; LogMgr.cpp instantiates it for
+ * every engine StorageEngine.h names.
+ */
+template <class Engine>
+class BasicLogMgr {
  private:
     /* tx id -> entryn */
   map <int, txTableEntry> tx_table;
     /* page id -> earliest redo lsn */
-  map <int, int> dirty_page_table;
+  map <int, LSN> dirty_page_table;
   vector <LogRecord*> logtail; 
+  /* async commits whose commit record is not on disk yet, oldest first */
+  vector <PendingCommit> pending_commits;
+  /* largest LSN written to disk by this LogMgr */
+  LSN flushedLSN = NULL_LSN;
+  /* largest LSN handed to the disk, which may still be in flight */
+  LSN writtenLSN = NULL_LSN;
+  /* logtail serialized, as appendLog made it: a record starts at its
+     LSN less the LSN of the first record in the tail */
+  string tail_text;
+  /* when the oldest record in the tail was logged */
+  chrono::steady_clock::time_point tail_since;
+  bool tail_timed = false;
+  /* the log writer thread, which runs holding the engine's latch */
+  thread writer_thread;
+  condition_variable_any writer_wake;
+  bool writer_running = false;
+  bool writer_stop = false;
+  LogMgrOptions options;
+  Metrics metrics;
+  /* log bytes written since the last checkpoint */
+  long long bytes_since_checkpoint = 0;
+  /* dirty page table size at the last checkpoint */
+  int dpt_pages_at_checkpoint = 0;
+  /* pages that got a full page image since the last checkpoint */
+  set<int> imaged_pages;
+  /* the tables as of the last checkpoint this LogMgr took, which the
+     next delta checkpoint is taken against */
+  map <int, txTableEntry> ckpt_tx_table;
+  map <int, LSN> ckpt_dirty_page_table;
+  LSN last_checkpoint_lsn = NULL_LSN;
+  /* delta checkpoints taken since the last full one */
+  int deltas_since_full = 0;
+  /* redo cost per log byte measured by the last recovery, or -1 */
+  double measured_us_per_byte = -1;
+  /* instant restart: page id -> records still to redo on it, oldest
+     first */
+  map <int, vector <LogRecord*> > pending_redo;
+  /* background undo: LSNs of losers still to undo */
+  priority_queue <LSN> undo_queue;
+  /* loser tx -> pages it changed, which only it may touch until it
+     has been rolled back */
+  map <int, set<int> > loser_pages;
+  /* the log recover() was given, and the records of it that it
+     parsed, kept while redo or undo still need them */
+  string recovery_text;
+  vector <LogRecord*> recovery_log;
+  /* snapshot reads: page id -> versions, oldest first, and the bytes
+     of before image they hold */
+  map <int, vector <PageVersion> > versions;
+  long long version_bytes = 0;
+  /* tx -> versions it has in the chain, and its commit LSN once it has
+     committed */
+  map <int, int> version_counts;
+  map <int, LSN> commit_lsns;
+  /* reading tx -> the LSN its snapshot was taken at; and readers whose
+     snapshot was dropped to bound the chain */
+  map <int, LSN> snapshots;
+  set <int> stale_snapshots;
+  /* recovery prefetch: the pages the running phase will need, in the
+     order it will first need them, each page's place in that order,
+     how many uses of each page are still ahead, and how many of them
+     have been handed to the engine so far */
+  vector <int> prefetch_order;
+  map <int, int> prefetch_pos;
+  map <int, int> prefetch_uses;
+  unsigned prefetch_next = 0;
 
   /*
    * Find the LSN of the most recent log record for this TX.
    * If there is no previous log record for this TX, return 
    * the null LSN.
    */
-  int getLastLSN(int txnum);
+  LSN getLastLSN(int txnum);
 
   /*
    * Update the TX table to reflect the LSN of the most recent
    * log entry for this transaction.
    */
-  void setLastLSN(int txnum, int lsn);
+  void setLastLSN(int txnum, LSN lsn);
 
   /*
    * Force log records up to and including the one with the
    * maxLSN to disk. Don't forget to remove them from the
    * logtail once they're written!
    */
-  void flushLogTail(int maxLSN);
+  void flushLogTail(LSN maxLSN);
+
+  /*
+   * Removes the records up to maxLSN from the log tail and returns them
+   * serialized, out of tail_text.
+   */
+  string takeLogTail(LSN maxLSN);
+
+  /*
+   * Hands the records up to maxLSN to the disk without waiting.
+   */
+  void writeLogTail(LSN maxLSN);
+
+  /*
+   * The background log writer: writes the tail out once it holds
+   * log_writer_bytes or its oldest record has waited
+   * log_writer_interval_ms.
+   */
+  void runLogWriter();
+
+  /*
+   * The log writer thread: runs runLogWriter every
+   * log_writer_interval_ms, so an idle tail is written out too, until
+   * this LogMgr is destroyed, the engine has crashed over to another
+   * LogMgr or the option is turned off.
+   */
+  void startLogWriter();
+  void logWriterLoop();
+
+  /*
+   * The log writer: forces the tail once the oldest pending async
+   * commit trails the newest log record by more than max_commit_lag.
+   */
+  void enforceCommitLag();
+
+  /*
+   * The checkpoint scheduler: estimates how long redo would take after
+   * a crash right now and takes a checkpoint if that, the log written
+   * since the last checkpoint, or the dirty page table is too large.
+   */
+  void scheduleCheckpoint();
+
+  /*
+   * Instant restart: redoes up to pages pages that no one has loaded
+   * yet.
+   */
+  void backgroundRedo(int pages);
 
-  StorageEngine* se;
+  /*
+   * The background work that follows every logged operation: the
+   * commit lag, the log writer, the checkpoint scheduler and
+   * background redo and undo.
+   */
+  void afterLog();
+
+  /*
+   * Adds record to the log tail; its LSN is where the log ends, which
+   * moves past it. The record is serialized here, once.
+   */
+  void appendLog(LogRecord* record);
+
+  /*
+   * The record at lsn: the one in the log tail if it is still there,
+   * or else parsed into parsed straight out of log, the log on disk.
+   * As LSNs are byte offsets, both are seeks. Returns nullptr if no
+   * record starts at lsn.
+   */
+  LogRecord* readRecord(const string& log, LSN lsn, unique_ptr<LogRecord>& parsed);
+
+  /*
+   * Background undo: takes over the losers left in the Tx table after
+   * redo and locks the pages they still have to restore.
+   */
+  void startBackgroundUndo(const string& log);
+
+  /*
+   * Background undo: handles up to steps records of the losers, and
+   * releases the pages of every loser that is rolled back.
+   */
+  void backgroundUndo(int steps);
+
+  /*
+   * Recovery prefetch: the pages redo will need from log index idx
+   * on, in the order it will need them. uses gets how many records
+   * redo will examine for each.
+   */
+  vector<int> redoPages(vector <LogRecord*>& log, int idx, map<int, int>& uses);
+
+  /*
+   * The pages undo will change following the chains from lsns back,
+   * newest LSN first, in the order it will change them. If uses is
+   * set, it gets how many records undo will change on each.
+   */
+  vector<int> undoPages(const string& log, priority_queue<LSN> lsns, map<int, int>* uses = nullptr);
+
+  /*
+   * Recovery prefetch: startPrefetch begins a phase that needs pages
+   * in order, uses[page] times each (an empty order ends it).
+   * prefetchFor is called before each use of a page, and once the
+   * phase gets past what has been prefetched it prefetches the next
+   * buffer pool's worth, never evicting a page with uses left.
+   */
+  void startPrefetch(vector<int> order, map<int, int> uses = map<int, int>());
+  void prefetchFor(int page_id);
+
+  /*
+   * Frees recovery_log and recovery_text once neither redo nor undo
+   * needs them.
+   */
+  void releaseRecoveryLog();
+
+  /*
+   * With full_page_images on, logs the page's current contents if this
+   * is its first modification since the last checkpoint.
+   */
+  void logPageImage(int page_id);
+
+  Engine* se;
 
   /* 
-   * Run the analysis phase of ARIES.
+   * Run the analysis phase of ARIES on log, the log on disk. Only the
+   * records from the last checkpoint on are parsed; they are returned.
    */
-  void analyze(vector <LogRecord*> log);
+  vector<LogRecord*> analyze(const string& log);
+
+  /*
+   * The smallest recLSN in the dirty page table, or NULL_LSN if it is
+   * empty.
+   */
+  LSN redoStartLSN();
+
+  /*
+   * Fold one log record into the Tx table and dirty page table.
+   */
+  void analyzeRecord(LogRecord* record);
 
   /*
    * Run the redo phase of ARIES.
@@ -57,13 +385,74 @@ class LogMgr {
    */
   bool redo(vector <LogRecord*> log);
 
+  /*
+   * Instant restart: build pending_redo from the log after analysis.
+   */
+  void planRedo(vector <LogRecord*> log);
+
+  /*
+   * Restartable recovery: write back the pages redone so far and
+   * checkpoint, so the next crash's redo starts at redo_from.
+   */
+  void redoCheckpoint(LSN redo_from);
+
+  /*
+   * Reapply one record's change to its page. Returns false if
+   * the StorageEngine refused the page write.
+   */
+  bool redoRecord(LogRecord* record);
+
+  /*
+   * Write an end record for every committed Tx in the Tx table.
+   */
+  void endCommitted();
+
   /*
    * If no txnum is specified, run the undo phase of ARIES.
    * If a txnum is provided, abort that transaction.
    * Hint: the logic is very similar for these two tasks!
+   * Records are read from log, the log on disk, or the log tail.
+   */
+  void undo(const string& log, int txnum = NULL_TX);
+
+  /*
+   * One step of undo: the record with the largest LSN in toUndo.
+   * Returns false if undo has to stop.
+   */
+  bool undoNext(const string& log, priority_queue<LSN>& toUndo);
+
+  /*
+   * Writes a begin and an end checkpoint. The end checkpoint is a delta
+   * against the last one unless full is set, delta_checkpoints is off,
+   * or it is time for a full one.
+   */
+  void takeCheckpoint(bool full);
+
+  /*
+   * With coalesce_writes on, tries to fold this update into the last
+   * record in the log tail. Returns that record's LSN if it did, or
+   * NULL_LSN.
+   */
+  LSN coalesceWrite(int txid, int page_id, int offset, string_view input, const string& oldtext);
+
+  /*
+   * Snapshot reads: adds a version to the chain; and drops the
+   * versions every snapshot can see past, and those of aborted
+   * transactions, then the oldest snapshots while the chain is over
+   * version_chain_bytes and dropping one would free some of it.
    */
-  void undo(vector <LogRecord*> log, int txnum = NULL_TX);
-  vector<LogRecord*> stringToLRVector(string logstring);
+  void addVersion(int txid, int page_id, LSN lsn, int offset, const string& before);
+  void collectVersions();
+
+  /*
+   * A transaction has ended: its snapshot is released and, if it
+   * aborted, its versions are dropped.
+   */
+  void endSnapshot(int txid, bool committed, LSN commit_lsn);
+  /*
+   * Parses the records in [from, to) of a log.
+   */
+  vector<LogRecord*> stringToLRVector(const string& logstring, size_t from = 0, size_t to = string::npos);
   
  public:
   /*
@@ -82,38 +471,146 @@ class LogMgr {
    */
   void commit(int txid);
 
+  /*
+   * Commit the specified transaction. If async is set, return as soon
+   * as the commit record is in the log tail; on_durable (if any) runs
+   * once that record has been written to disk.
+   */
+  void commit(int txid, bool async, DurableCallback on_durable = nullptr);
+
   /*
    * A function that StorageEngine will call when it's about to 
-   * write a page to disk. 
+   * write a batch of pages to disk, flush_lsn being the newest
+   * pageLSN among them.
    * Remember, you need to implement write-ahead logging
    */
-  void pageFlushed(int page_id);
+  void pagesFlushed(LSN flush_lsn);
+
+  /*
+   * Called by StorageEngine once the pages of that batch that reached
+   * the disk are there.
+   */
+  void pagesWritten(const vector<int>& page_ids);
 
   /*
    * Recover from a crash, given the log from the disk.
    */
   void recover(string log);
 
+  /*
+   * Finishes the redo an instant restart still owes and the rollback
+   * background undo still owes. Every checkpoint calls it, and so
+   * does StorageEngine::end, so neither outlives the next checkpoint.
+   */
+  void finishRecovery();
+
+  /*
+   * Called by StorageEngine before txid changes page_id. If a loser
+   * still being rolled back in the background holds the page, waits
+   * for (that is, finishes) its rollback first.
+   */
+  void lockPage(int txid, int page_id);
+
+  /*
+   * Called by StorageEngine with the current bytes of a range of
+   * page_id. Rebuilds data as of txid's snapshot (taken at its first
+   * read): its own changes and those committed by then. Returns false
+   * if the snapshot was dropped to bound the version chain, or if
+   * snapshot_reads is off.
+   */
+  bool snapshotRead(int txid, int page_id, int offset, string& data);
+
+  /*
+   * Called by StorageEngine when it loads a page into the buffer.
+   * After an instant restart, redoes whatever the log still has for it.
+   */
+  void pageLoaded(int page_id);
+
+  /*
+   * Standby apply: folds one record of a primary's log into the tables
+   * the way analysis does and redoes it if its page is older. Takes
+   * ownership of record.
+   */
+  void replayRecord(LogRecord* record);
+
+  /*
+   * Turns a standby into a primary: what recovery would still do after
+   * analysis and redo. Ends the committed transactions and rolls back
+   * the ones that were in flight.
+   */
+  void promote();
+
+  /*
+   * Takes an online backup of the database into path while
+   * transactions keep running. Returns false if it cannot be written.
+   */
+  bool backup(string path);
+
+  /*
+   * Point-in-time restore, on an engine that has loaded a backup:
+   * replays log (the archived log from info.log_offset on) up to and
+   * including target_lsn, then rolls back whatever was in flight
+   * there. Returns false if target_lsn comes before the backup's
+   * checkpoint, the first point the backup is consistent at.
+   */
+  bool restore(string log, BackupInfo info, LSN target_lsn);
+
   /*
    * Logs an update to the database and updates tables if needed.
+   * The log record takes over oldtext; input is copied into it.
    */
-  int write(int txid, int page_id, int offset, string input, string oldtext);
+  LSN write(int txid, int page_id, int offset, string_view input, string oldtext);
+
+  /*
+   * Logs a batch of updates to a single page as one multi-extent
+   * record (which takes over extents) and updates tables if needed.
+   */
+  LSN writeExtents(int txid, int page_id, vector<UpdateExtent> extents);
 
   /*
    * Sets this.se to engine. 
    */
-  void setStorageEngine(StorageEngine* engine);
+  void setStorageEngine(Engine* engine);
+
+  /*
+   * Replaces the options for this LogMgr.
+   */
+  void setOptions(LogMgrOptions new_options);
+
+  /*
+   * Counters and gauges describing this LogMgr's work.
+   */
+  Metrics& getMetrics() {return metrics;}
+
+  /*
+   * Stops the log writer thread, if there is one, and waits for it to
+   * finish. The caller must not hold the engine's latch.
+   */
+  void stopLogWriter() {
+    if (writer_thread.joinable()) {
+      {
+        lock_guard<recursive_mutex> guard(se->getLatch());
+        writer_stop = true;
+      }
+      writer_wake.notify_all();
+      writer_thread.join();
+    }
+  }
 
   //destructor
-  ~LogMgr() {
+  ~BasicLogMgr() {
+    stopLogWriter();
     while (!logtail.empty()) {
       delete logtail[0];
       logtail.erase(logtail.begin());
     }
+    for (unsigned i = 0; i < recovery_log.size(); ++i) {
+      delete recovery_log[i];
+    }
   }
   //copy constructor omitted
   //Overloaded assignment operator
-  LogMgr &operator= (const LogMgr &rhs) {
+  BasicLogMgr &operator= (const BasicLogMgr &rhs) {
     if (this == &rhs) return *this;
     //delete anything in the logtail vector
     while (!logtail.empty()) {
@@ -122,8 +619,8 @@ class LogMgr {
     }
     for (vector<LogRecord*>::const_iterator it = rhs.logtail.begin(); it !=rhs.logtail.end(); ++it) {
       LogRecord * lr = *it;
-      int lsn = lr->getLSN();
-      int prevLSN = lr->getprevLSN();
+      LSN lsn = lr->getLSN();
+      LSN prevLSN = lr->getprevLSN();
       int txid = lr->getTxID();
       TxType type = lr->getType();
       if (type == UPDATE) {
@@ -135,27 +632,65 @@ class LogMgr {
 	UpdateLogRecord* cpy_lr = new UpdateLogRecord(lsn, prevLSN, txid, page_id, offset, 
 						      before, after);
 	logtail.push_back(cpy_lr);
+      } else if (type == MULTI_UPDATE) {
+	MultiUpdateLogRecord* mlr = dynamic_cast<MultiUpdateLogRecord *>(lr);
+	MultiUpdateLogRecord* cpy_lr = new MultiUpdateLogRecord(lsn, prevLSN, txid, mlr->getPageID(),
+								mlr->getExtents());
+	logtail.push_back(cpy_lr);
+      } else if (type == PAGE_IMAGE) {
+	PageImageLogRecord* plr = dynamic_cast<PageImageLogRecord *>(lr);
+	logtail.push_back(new PageImageLogRecord(lsn, plr->getPageID(), plr->getImage()));
+      } else if (type == PAGE_FLUSH) {
+	PageFlushLogRecord* flr = dynamic_cast<PageFlushLogRecord *>(lr);
+	logtail.push_back(new PageFlushLogRecord(lsn, flr->getPageID(), flr->getFlushedLSN()));
       } else if (type == CLR) {
 	CompensationLogRecord* clr = dynamic_cast<CompensationLogRecord *>(lr);
 	int page_id = clr->getPageID();
 	int offset  = clr->getOffset();
 	string after = clr->getAfterImage();
-	int nextLSN = clr->getUndoNextLSN();
+	LSN nextLSN = clr->getUndoNextLSN();
 	CompensationLogRecord* cpy_lr = new CompensationLogRecord(lsn, prevLSN, txid, page_id, offset, 
 								  after, nextLSN);
 	logtail.push_back(cpy_lr);
       } else if (type == END_CKPT) {
 	ChkptLogRecord * chk_ptr = dynamic_cast<ChkptLogRecord *>(lr);
 	map <int, txTableEntry> tx_table = chk_ptr->getTxTable();
-	map <int, int> dp_table = chk_ptr->getDirtyPageTable();
+	map <int, LSN> dp_table = chk_ptr->getDirtyPageTable();
 	ChkptLogRecord * cpy_lr = new ChkptLogRecord(lsn, prevLSN, txid, tx_table, dp_table);
 	logtail.push_back(cpy_lr);
+      } else if (type == DELTA_CKPT) {
+	DeltaChkptLogRecord * dlr = dynamic_cast<DeltaChkptLogRecord *>(lr);
+	logtail.push_back(new DeltaChkptLogRecord(lsn, prevLSN, dlr->getBaseLSN(),
+						  dlr->getTxTable(), dlr->getDirtyPageTable(),
+						  dlr->getRemovedTxs(), dlr->getRemovedPages()));
       } else { //type is ordinary log record
 	LogRecord * cpy_lr = new LogRecord(lsn, prevLSN, txid, type);
 	logtail.push_back(cpy_lr);
       }
     }
     se = rhs.se;
+    pending_commits = rhs.pending_commits;
+    flushedLSN = rhs.flushedLSN;
+    writtenLSN = rhs.writtenLSN;
+    tail_text = rhs.tail_text;
+    tail_since = rhs.tail_since;
+    tail_timed = rhs.tail_timed;
+    options = rhs.options;
+    metrics = rhs.metrics;
+    bytes_since_checkpoint = rhs.bytes_since_checkpoint;
+    dpt_pages_at_checkpoint = rhs.dpt_pages_at_checkpoint;
+    measured_us_per_byte = rhs.measured_us_per_byte;
+    imaged_pages = rhs.imaged_pages;
+    versions = rhs.versions;
+    version_bytes = rhs.version_bytes;
+    version_counts = rhs.version_counts;
+    commit_lsns = rhs.commit_lsns;
+    snapshots = rhs.snapshots;
+    stale_snapshots = rhs.stale_snapshots;
+    ckpt_tx_table = rhs.ckpt_tx_table;
+    ckpt_dirty_page_table = rhs.ckpt_dirty_page_table;
+    last_checkpoint_lsn = rhs.last_checkpoint_lsn;
+    deltas_since_full = rhs.deltas_since_full;
     tx_table = rhs.tx_table;
     dirty_page_table = rhs.dirty_page_table;
     return *this;
@@ -165,6 +700,11 @@ class LogMgr {
   
 };
 
+typedef BasicLogMgr<StorageEngine> LogMgr;
+typedef BasicLogMgr<MemoryStorageEngine> MemoryLogMgr;
+typedef BasicLogMgr<FileStorageEngine> FileLogMgr;
+typedef BasicLogMgr<DirectStorageEngine> DirectLogMgr;
+
 /////////////////// End LogMgr  ///////////////////
 
 #endif
@@ -1,80 +1,207 @@
 #include "LogRecord.h"
-#include <sstream>
+#include <charconv>
+#include <cstring>
+#include <algorithm>
+#include <thread>
 
 using namespace std;
 
+namespace {
+
+/*
+ * Reads the fields of one log line in place. Numbers go through
+ * from_chars and text fields are handed back as [begin, end) ranges,
+ * so parsing a field never allocates; only the record itself and the
+ * images it keeps do.
+ */
+struct LineCursor {
+  const char* p;
+  const char* end;
+
+  LineCursor(const char* line_begin, const char* line_end) : p(line_begin), end(line_end) {}
+
+  void skipSpace() {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+      ++p;
+  }
+
+  //Leaves value untouched if there is no number here.
+  template <typename T>
+  void readInt(T& value) {
+    skipSpace();
+    from_chars_result r = from_chars(p, end, value);
+    if (r.ec == errc())
+      p = r.ptr;
+  }
+
+  void readToken(const char*& token_begin, const char*& token_end) {
+    skipSpace();
+    token_begin = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+      ++p;
+    token_end = p;
+  }
+
+  string readString() {
+    const char *b, *e;
+    readToken(b, e);
+    return string(b, e);
+  }
+
+  bool accept(char c) {
+    skipSpace();
+    if (p < end && *p == c) {
+      ++p;
+      return true;
+    }
+    return false;
+  }
+};
+
+bool tokenIs(const char* b, const char* e, const char* word) {
+  size_t len = strlen(word);
+  return (size_t)(e - b) == len && memcmp(b, word, len) == 0;
+}
+
+//parse a tx table map: { [ tx lastLSN U|C ] ... }
+void readTxMap(LineCursor& cur, map<int, txTableEntry>& txmap) {
+  const char *tb, *te;
+  cur.accept('{');
+  while (cur.accept('[')) {
+    int tx_int = 0;
+    LSN lastLSN = 0;
+    cur.readInt(tx_int);
+    cur.readInt(lastLSN);
+    cur.readToken(tb, te);
+    TxStatus status = tokenIs(tb, te, "U") ? U : C;
+    txmap.insert(pair<int, txTableEntry>(tx_int, txTableEntry(lastLSN, status)));
+    cur.accept(']');
+  }
+  cur.accept('}');
+}
+
+//parse a dirty page table map: { [ page recLSN ] ... }
+void readIntMap(LineCursor& cur, map<int, LSN>& intmap) {
+  cur.accept('{');
+  while (cur.accept('[')) {
+    int i = 0;
+    LSN j = 0;
+    cur.readInt(i);
+    cur.readInt(j);
+    intmap.insert(pair<int, LSN>(i,j));
+    cur.accept(']');
+  }
+  cur.accept('}');
+}
+
+//parse a list of ids: { [ id ] ... }
+void readIntList(LineCursor& cur, vector<int>& list) {
+  cur.accept('{');
+  while (cur.accept('[')) {
+    int i = 0;
+    cur.readInt(i);
+    list.push_back(i);
+    cur.accept(']');
+  }
+  cur.accept('}');
+}
+
+} //namespace
+
 LogRecord* LogRecord::stringToRecordPtr(string rec_string){
-  stringstream ss(rec_string);
-  int lsn, prevLSN, txID;
-  string str_type;
+  return parseRecord(rec_string.data(), rec_string.data() + rec_string.size());
+}
+
+LogRecord* LogRecord::parseRecord(const char* line_begin, const char* line_end){
+  LineCursor cur(line_begin, line_end);
+  LSN lsn = 0, prevLSN = 0;
+  int txID = 0;
+  const char *tb, *te;
   TxType type = UPDATE; //initializing arbitrarily to get rid of compiler warning.
-  ss >> lsn >> prevLSN >> txID >> str_type;
-  if (str_type == "update") {
+  cur.readInt(lsn);
+  cur.readInt(prevLSN);
+  cur.readInt(txID);
+  cur.readToken(tb, te);
+  if (tokenIs(tb, te, "update")) {
     type = UPDATE;
-    int pageID, offset;
-    string before_image, after_image;
-    ss >> pageID >> offset >> before_image >> after_image;
-    UpdateLogRecord* ulr = new UpdateLogRecord(lsn, prevLSN, txID, pageID, offset, before_image, after_image); 
+    int pageID = 0, offset = 0;
+    cur.readInt(pageID);
+    cur.readInt(offset);
+    string before_image = cur.readString();
+    string after_image = cur.readString();
+    UpdateLogRecord* ulr = new UpdateLogRecord(lsn, prevLSN, txID, pageID, offset, move(before_image), move(after_image)); 
     return ulr;
-  } else if (str_type == "CLR") {
+  } else if (tokenIs(tb, te, "multi_update")) {
+    type = MULTI_UPDATE;
+    int pageID = 0, count = 0;
+    cur.readInt(pageID);
+    cur.readInt(count);
+    vector<UpdateExtent> extents(count);
+    for (int i = 0; i < count; ++i) {
+      cur.readInt(extents[i].offset);
+      extents[i].beforeImage = cur.readString();
+      extents[i].afterImage = cur.readString();
+    }
+    MultiUpdateLogRecord* mlr = new MultiUpdateLogRecord(lsn, prevLSN, txID, pageID, move(extents));
+    return mlr;
+  } else if (tokenIs(tb, te, "page_image")) {
+    type = PAGE_IMAGE;
+    int pageID = 0;
+    cur.readInt(pageID);
+    string image = cur.readString();
+    return new PageImageLogRecord(lsn, pageID, move(image));
+  } else if (tokenIs(tb, te, "page_flush")) {
+    type = PAGE_FLUSH;
+    int pageID = 0;
+    LSN flushedLSN = 0;
+    cur.readInt(pageID);
+    cur.readInt(flushedLSN);
+    return new PageFlushLogRecord(lsn, pageID, flushedLSN);
+  } else if (tokenIs(tb, te, "CLR")) {
     type = CLR;
-    int pageID, offset, undoNextLSN;
-    string after_image;
-    ss >> pageID >> offset >> after_image >> undoNextLSN;
+    int pageID = 0, offset = 0;
+    LSN undoNextLSN = 0;
+    cur.readInt(pageID);
+    cur.readInt(offset);
+    string after_image = cur.readString();
+    cur.readInt(undoNextLSN);
     CompensationLogRecord* clr = new CompensationLogRecord(lsn,prevLSN, txID,
-							  pageID, offset, after_image,
+							  pageID, offset, move(after_image),
 							  undoNextLSN);
 
     return clr;
-  } else if (str_type == "end_checkpoint") {
+  } else if (tokenIs(tb, te, "end_checkpoint")) {
     type = END_CKPT;
     map<int, txTableEntry> txmap;
-    map<int, int> dirtypagemap;
-    string curly;
-    ss >> curly;
-    //parse the tx table map
-    string txmapstr;
-    getline(ss, txmapstr, '}');
-    stringstream ss2(txmapstr);
-    string item;
-    while (getline(ss2, item, ']')) {
-      stringstream ss3(item);
-      string square, status_str;
-      int tx_int, lastLSN;
-      ss3 >> square >> tx_int >> lastLSN >> status_str;
-      TxStatus status;
-      if (status_str == "U")
-	status = U;
-      else
-	status = C;
-      txTableEntry entry = txTableEntry(lastLSN, status);
-      txmap.insert(pair<int, txTableEntry>(tx_int, entry));
-    }
-    ss >> curly;
-    //parse the dirty page table map
-    string dpmapstr;
-    getline(ss, dpmapstr, '}');
-    stringstream ss4(dpmapstr);
-    string item2;
-    while (getline(ss4, item2, ']')) {
-      stringstream ss3(item2);
-      string square;
-      int i, j;
-      ss3 >> square >> i >> j;
-      dirtypagemap.insert(pair<int, int>(i,j));
-    }
+    map<int, LSN> dirtypagemap;
+    readTxMap(cur, txmap);
+    readIntMap(cur, dirtypagemap);
     ChkptLogRecord* chlr = new ChkptLogRecord(lsn, prevLSN, txID, 
 					      txmap, dirtypagemap);
     return chlr;
 
+  } else if (tokenIs(tb, te, "delta_checkpoint")) {
+    type = DELTA_CKPT;
+    LSN baseLSN = 0;
+    map<int, txTableEntry> txmap;
+    map<int, LSN> dirtypagemap;
+    vector<int> removed_txs, removed_pages;
+    cur.readInt(baseLSN);
+    readTxMap(cur, txmap);
+    readIntMap(cur, dirtypagemap);
+    readIntList(cur, removed_txs);
+    readIntList(cur, removed_pages);
+    return new DeltaChkptLogRecord(lsn, prevLSN, baseLSN, txmap, dirtypagemap,
+				   removed_txs, removed_pages);
+
   } else {
-    if (str_type == "commit") {
+    if (tokenIs(tb, te, "commit")) {
       type = COMMIT;
-    } else if (str_type == "abort") {
+    } else if (tokenIs(tb, te, "abort")) {
       type = ABORT;
-    } else if (str_type == "end") {
+    } else if (tokenIs(tb, te, "end")) {
       type = END;
-    } else if (str_type == "begin_checkpoint") {
+    } else if (tokenIs(tb, te, "begin_checkpoint")) {
       type = BEGIN_CKPT;
     }
     LogRecord* lr = new LogRecord(lsn, prevLSN, txID, type);
@@ -83,93 +210,252 @@ LogRecord* LogRecord::stringToRecordPtr(string rec_string){
   
 }
 
+/*
+ * Parses every non-empty line in [begin, end).
+ */
+static vector<LogRecord*> parseLines(const char* begin, const char* end) {
+  vector<LogRecord*> records;
+  const char* line = begin;
+  while (line < end) {
+    //memchr is vectorized in glibc, so this is the SIMD newline scan
+    const char* nl = static_cast<const char*>(memchr(line, '\n', end - line));
+    const char* line_end = nl ? nl : end;
+    if (line_end > line)
+      records.push_back(LogRecord::parseRecord(line, line_end));
+    line = line_end + 1;
+  }
+  return records;
+}
+
+vector<LogRecord*> LogRecord::stringToRecordVector(const string& log, unsigned threads){
+  return stringToRecordVector(log.data(), log.data() + log.size(), threads);
+}
+
+vector<LogRecord*> LogRecord::stringToRecordVector(const char* begin, const char* end, unsigned threads){
+  size_t size = end - begin;
+  if (threads <= 1 || size == 0)
+    return parseLines(begin, end);
+
+  //cut the log into roughly equal, line-aligned chunks
+  vector<const char*> cuts(1, begin);
+  for (unsigned i = 1; i < threads; ++i) {
+    const char* cut = max(begin + size / threads * i, cuts.back());
+    const char* nl = static_cast<const char*>(memchr(cut, '\n', end - cut));
+    cuts.push_back(nl ? nl + 1 : end);
+  }
+  cuts.push_back(end);
+
+  vector<vector<LogRecord*> > parts(threads);
+  vector<thread> workers;
+  for (unsigned i = 0; i < threads; ++i)
+    workers.push_back(thread([&parts, &cuts, i]() {
+	  parts[i] = parseLines(cuts[i], cuts[i + 1]);
+	}));
+  for (unsigned i = 0; i < threads; ++i)
+    workers[i].join();
+
+  size_t total = 0;
+  for (unsigned i = 0; i < threads; ++i)
+    total += parts[i].size();
+  vector<LogRecord*> records;
+  records.reserve(total);
+  for (unsigned i = 0; i < threads; ++i)
+    records.insert(records.end(), parts[i].begin(), parts[i].end());
+  return records;
+}
+
 string LogRecord::toString() {
-  string result = basicToString();
-  result.append("\n");
+  string result;
+  appendTo(result);
   return result;
 }
 
-string LogRecord::basicToString() {
-    string result = "";
-    result.append(to_string(lsn));
-    result.append("\t");
-    result.append(to_string(prevLSN));
-    result.append("\t");
-    result.append(to_string(txID));
-    result.append("\t");
+void LogRecord::appendTo(string& out) {
+  appendBasic(out);
+  out.append("\n");
+}
+
+void LogRecord::appendBasic(string& out) {
+    out.append(to_string(lsn));
+    out.append("\t");
+    out.append(to_string(prevLSN));
+    out.append("\t");
+    out.append(to_string(txID));
+    out.append("\t");
 
     switch (type) {
     case UPDATE:
-      result.append("update");
+      out.append("update");
       break;
     case COMMIT:
-      result.append("commit");
+      out.append("commit");
       break;
     case ABORT:
-      result.append("abort");
+      out.append("abort");
       break;
     case END:
-      result.append("end");
+      out.append("end");
       break;
     case CLR:
-      result.append("CLR");
+      out.append("CLR");
       break;
     case BEGIN_CKPT:
-      result.append("begin_checkpoint");
+      out.append("begin_checkpoint");
       break;
     case END_CKPT:
-      result.append("end_checkpoint");
+      out.append("end_checkpoint");
       break;    
+    case DELTA_CKPT:
+      out.append("delta_checkpoint");
+      break;
+    case MULTI_UPDATE:
+      out.append("multi_update");
+      break;
+    case PAGE_IMAGE:
+      out.append("page_image");
+      break;
+    case PAGE_FLUSH:
+      out.append("page_flush");
+      break;
     }
-    
-    return result;
   }
 
 
 
-string UpdateLogRecord::toString() {
-  string result = basicToString();
-  result.append("\t");
-  result.append(to_string(pid));
-  result.append("\t");
-  result.append(to_string(offset));
-  result.append("\t");
-  result.append(beforeImage);
-  result.append("\t");
-  result.append(afterImage);
-  result.append("\n");
-  return result;
+bool UpdateLogRecord::coalesce(int page_offset, const string& before_img, const string& after_img) {
+  int end = offset + (int)afterImage.size();
+  int new_end = page_offset + (int)after_img.size();
+  if (page_offset > end || new_end < offset)
+    return false;
+  //the ranges touch, so together they cover [start, stop)
+  int start = min(offset, page_offset);
+  int stop = max(end, new_end);
+  //before: ours where we have it; elsewhere the later update's, as
+  //bytes we did not touch still held their original contents then
+  string before(stop - start, ' ');
+  before.replace(page_offset - start, before_img.size(), before_img);
+  before.replace(offset - start, beforeImage.size(), beforeImage);
+  //after: the later update's where it wrote, ours elsewhere
+  string after(stop - start, ' ');
+  after.replace(offset - start, afterImage.size(), afterImage);
+  after.replace(page_offset - start, after_img.size(), after_img);
+  offset = start;
+  beforeImage = move(before);
+  afterImage = move(after);
+  return true;
 }
 
+void UpdateLogRecord::appendTo(string& out) {
+  appendBasic(out);
+  out.append("\t");
+  out.append(to_string(pid));
+  out.append("\t");
+  out.append(to_string(offset));
+  out.append("\t");
+  out.append(beforeImage);
+  out.append("\t");
+  out.append(afterImage);
+  out.append("\n");
+}
 
 
-string CompensationLogRecord::toString() {
-  string result = basicToString();
-  result.append("\t");
-  result.append(to_string(pageID));
-  result.append("\t");
-  result.append(to_string(offset));
-  result.append("\t");
-  result.append(afterImage);
-  result.append("\t");
-  result.append(to_string(undoNextLSN));
-  result.append("\n");
-  return result;
+void MultiUpdateLogRecord::appendTo(string& out) {
+  appendBasic(out);
+  out.append("\t");
+  out.append(to_string(pid));
+  out.append("\t");
+  out.append(to_string(extents.size()));
+  for (unsigned i = 0; i < extents.size(); ++i) {
+    out.append("\t");
+    out.append(to_string(extents[i].offset));
+    out.append("\t");
+    out.append(extents[i].beforeImage);
+    out.append("\t");
+    out.append(extents[i].afterImage);
+  }
+  out.append("\n");
 }
 
-string ChkptLogRecord::toString() {
-  string result = basicToString();
-  result.append("\t");
-  result.append(txMapToString(txTable));
-  result.append("\t");
-  result.append(intMapToString(dirtyPageTable));
-  result.append("\n");
+void PageImageLogRecord::appendTo(string& out) {
+  appendBasic(out);
+  out.append("\t");
+  out.append(to_string(pid));
+  out.append("\t");
+  out.append(image);
+  out.append("\n");
+}
+
+void PageFlushLogRecord::appendTo(string& out) {
+  appendBasic(out);
+  out.append("\t");
+  out.append(to_string(pid));
+  out.append("\t");
+  out.append(to_string(flushedLSN));
+  out.append("\n");
+}
+
+void CompensationLogRecord::appendTo(string& out) {
+  appendBasic(out);
+  out.append("\t");
+  out.append(to_string(pageID));
+  out.append("\t");
+  out.append(to_string(offset));
+  out.append("\t");
+  out.append(afterImage);
+  out.append("\t");
+  out.append(to_string(undoNextLSN));
+  out.append("\n");
+}
+
+void ChkptLogRecord::appendTo(string& out) {
+  appendBasic(out);
+  out.append("\t");
+  out.append(txMapToString(txTable));
+  out.append("\t");
+  out.append(intMapToString(dirtyPageTable));
+  out.append("\n");
+}
+
+void DeltaChkptLogRecord::appendTo(string& out) {
+  appendBasic(out);
+  out.append("\t");
+  out.append(to_string(baseLSN));
+  out.append("\t");
+  out.append(txMapToString(txTable));
+  out.append("\t");
+  out.append(intMapToString(dirtyPageTable));
+  out.append("\t");
+  out.append(intListToString(removedTxs));
+  out.append("\t");
+  out.append(intListToString(removedPages));
+  out.append("\n");
+}
+
+void DeltaChkptLogRecord::applyTo(map <int, txTableEntry>& tx_table, map <int, LSN>& dirty_page_table) {
+  for (unsigned i = 0; i < removedTxs.size(); ++i)
+    tx_table.erase(removedTxs[i]);
+  for (unsigned i = 0; i < removedPages.size(); ++i)
+    dirty_page_table.erase(removedPages[i]);
+  for (map<int,txTableEntry>::iterator it = txTable.begin(); it != txTable.end(); ++it)
+    tx_table[it->first] = it->second;
+  for (map<int,LSN>::iterator it = dirtyPageTable.begin(); it != dirtyPageTable.end(); ++it)
+    dirty_page_table[it->first] = it->second;
+}
+
+string DeltaChkptLogRecord::intListToString(vector <int> myList) {
+  string result = "{";
+  for (unsigned i = 0; i < myList.size(); ++i) {
+    result.append(" [ ");
+    result.append(to_string(myList[i]));
+    result.append(" ]");
+  }
+  result.append("}");
   return result;
 }
 
-string ChkptLogRecord::intMapToString(map <int, int> myMap) {
+string ChkptLogRecord::intMapToString(map <int, LSN> myMap) {
   string result = "{";
-  for (map<int,int>::iterator it = myMap.begin(); 
+  for (map<int,LSN>::iterator it = myMap.begin(); 
 	 it != myMap.end(); ++it) {
     result.append(" [ ");
     result.append(to_string(it->first));
@@ -1,71 +1,109 @@
 #include <string>
 #include <map>
+#include <vector>
+#include <utility>
+#include "../StorageEngine/Lsn.h"
 
 using namespace std;
 
 enum TxStatus {U, C};
-enum TxType {UPDATE, COMMIT, ABORT, END, CLR, BEGIN_CKPT, END_CKPT};
+enum TxType {UPDATE, COMMIT, ABORT, END, CLR, BEGIN_CKPT, END_CKPT, MULTI_UPDATE, PAGE_IMAGE, PAGE_FLUSH, DELTA_CKPT};
 
 struct txTableEntry {
-  int lastLSN;
+  LSN lastLSN;
   TxStatus status;
   txTableEntry(){};
-  txTableEntry(int lsn, TxStatus stat) {lastLSN=lsn; status=stat; };
+  txTableEntry(LSN lsn, TxStatus stat) {lastLSN=lsn; status=stat; };
+};
+
+//One (offset, before, after) piece of a multi-extent update.
+struct UpdateExtent {
+  int offset;
+  string beforeImage;
+  string afterImage;
+  UpdateExtent(){};
+  UpdateExtent(int off, string before, string after) {
+    offset=off; beforeImage=move(before); afterImage=move(after); };
 };
 
 ///////////////////  LogRecord  ///////////////////
 
 class LogRecord {
  public:
- LogRecord(int lsn_in, int prev_lsn, int tx_id, TxType txtype) :
+ LogRecord(LSN lsn_in, LSN prev_lsn, int tx_id, TxType txtype) :
   lsn(lsn_in), prevLSN(prev_lsn), txID(tx_id), type(txtype) {}
 
   static LogRecord* stringToRecordPtr(string rec_string);
 
-  virtual string toString();
+  /*
+   * Parses the single log line [line_begin, line_end) without copying it.
+   */
+  static LogRecord* parseRecord(const char* line_begin, const char* line_end);
+
+  /*
+   * Parses every line of a (multi-line) log string. With threads > 1
+   * the log is cut into line-aligned chunks parsed in parallel; the
+   * records still come back in log order. The second form parses the
+   * part [begin, end) of a log, which has to start at a record.
+   */
+  static vector<LogRecord*> stringToRecordVector(const string& log, unsigned threads = 1);
+  static vector<LogRecord*> stringToRecordVector(const char* begin, const char* end, unsigned threads = 1);
+
+  //Appends the record's line to out, so the log tail can serialize
+  //records straight into its text; toString returns it on its own
+  virtual void appendTo(string& out);
+  string toString();
 
   virtual ~LogRecord() {}
 
-  int getLSN() {return lsn;}
-  int getprevLSN() {return prevLSN;}
+  LSN getLSN() {return lsn;}
+  LSN getprevLSN() {return prevLSN;}
   int getTxID() {return txID;}
   TxType getType(){return type;}
   
 
  protected:
-  int lsn;
-  int prevLSN;
+  LSN lsn;
+  LSN prevLSN;
   int txID;
   TxType type;
 
-  //Make a string with the lsn, prevLSN, txID, and type
-  //for use in this and the subclass toString functions
-  string basicToString();  
+  //Append the lsn, prevLSN, txID, and type to out
+  //for use in this and the subclass appendTo functions
+  void appendBasic(string& out);
 };
 ///////////////////  End LogRecord  ///////////////////
 
 ///////////////////  UpdateLogRecord  ///////////////////
+//Images are taken by value and moved in; pass temporaries (or move)
+//so the record owns them without another copy.
 class UpdateLogRecord : public LogRecord{
  public:
-  UpdateLogRecord(int lsn_in, int prev_lsn, int tx_id, 
+  UpdateLogRecord(LSN lsn_in, LSN prev_lsn, int tx_id, 
 		 int page_id, int page_offset, 
 		 string before_img, string after_img) :
   LogRecord(lsn_in, prev_lsn, tx_id, UPDATE)
     {
         pid = page_id; 
         offset = page_offset;
-        beforeImage = before_img;
-        afterImage = after_img;
+        beforeImage = move(before_img);
+        afterImage = move(after_img);
     }
 
 
 
   int getPageID() {return pid;}
   int getOffset() {return offset;}
-  string getBeforeImage() {return beforeImage;}
-  string getAfterImage() {return afterImage;}
+  const string& getBeforeImage() {return beforeImage;}
+  const string& getAfterImage() {return afterImage;}
 
-  virtual string toString();
+  //Folds a later update of the same page into this record, if its
+  //range overlaps or touches this one: the record then covers both
+  //ranges, with the images from before the first update and after the
+  //second. Returns false (and changes nothing) if the ranges are apart.
+  bool coalesce(int page_offset, const string& before_img, const string& after_img);
+
+  virtual void appendTo(string& out);
 
  private:
   int pid;
@@ -75,28 +113,89 @@ class UpdateLogRecord : public LogRecord{
 };
 ///////////////////  End UpdateLogRecord  ///////////////////
 
+///////////////////  MultiUpdateLogRecord  ///////////////////
+//All the extents one batched write changed on a single page.
+//Extents are kept in the order they were applied, so redo applies
+//them front to back and undo restores them back to front.
+class MultiUpdateLogRecord : public LogRecord{
+ public:
+  MultiUpdateLogRecord(LSN lsn_in, LSN prev_lsn, int tx_id,
+		       int page_id, vector<UpdateExtent> page_extents) :
+  LogRecord(lsn_in, prev_lsn, tx_id, MULTI_UPDATE), pid(page_id),
+    extents(move(page_extents)) {}
+
+  int getPageID() {return pid;}
+  const vector<UpdateExtent>& getExtents() {return extents;}
+
+  virtual void appendTo(string& out);
+
+ private:
+  int pid;
+  vector<UpdateExtent> extents;
+};
+///////////////////  End MultiUpdateLogRecord  ///////////////////
+
+///////////////////  PageImageLogRecord  ///////////////////
+//The whole page as it was the first time it was dirtied after a
+//checkpoint. Not part of any transaction: txID and prevLSN are null.
+//Redo installs the image and replays only the records after it.
+class PageImageLogRecord : public LogRecord{
+ public:
+  PageImageLogRecord(LSN lsn_in, int page_id, string page_image) :
+  LogRecord(lsn_in, -1, -1, PAGE_IMAGE), pid(page_id), image(move(page_image)) {}
+
+  int getPageID() {return pid;}
+  const string& getImage() {return image;}
+
+  virtual void appendTo(string& out);
+
+ private:
+  int pid;
+  string image;
+};
+///////////////////  End PageImageLogRecord  ///////////////////
+
+///////////////////  PageFlushLogRecord  ///////////////////
+//Page pid reached disk with every change up to flushedLSN. Not part of
+//any transaction. Analysis drops the page from the dirty page table.
+class PageFlushLogRecord : public LogRecord{
+ public:
+  PageFlushLogRecord(LSN lsn_in, int page_id, LSN flushed_lsn) :
+  LogRecord(lsn_in, -1, -1, PAGE_FLUSH), pid(page_id), flushedLSN(flushed_lsn) {}
+
+  int getPageID() {return pid;}
+  LSN getFlushedLSN() {return flushedLSN;}
+
+  virtual void appendTo(string& out);
+
+ private:
+  int pid;
+  LSN flushedLSN;
+};
+///////////////////  End PageFlushLogRecord  ///////////////////
+
 ///////////////////  CompensationLogRecord  ///////////////////
 class CompensationLogRecord : public LogRecord{
  public:
- CompensationLogRecord(int lsn_in, int prev_lsn, int tx_id, 
+ CompensationLogRecord(LSN lsn_in, LSN prev_lsn, int tx_id, 
 		       int page_id, int page_offset,
-		       string after_img, int undo_next_lsn) :
+		       string after_img, LSN undo_next_lsn) :
   LogRecord(lsn_in, prev_lsn, tx_id, CLR), pageID(page_id),
-    offset(page_offset), afterImage(after_img),
+    offset(page_offset), afterImage(move(after_img)),
     undoNextLSN(undo_next_lsn) {}
 
-  virtual string toString();
+  virtual void appendTo(string& out);
 
   int getPageID() {return pageID;}
   int getOffset() {return offset;}
-  string getAfterImage() {return afterImage;}
-  int getUndoNextLSN() {return undoNextLSN;}
+  const string& getAfterImage() {return afterImage;}
+  LSN getUndoNextLSN() {return undoNextLSN;}
  private: 
   int pageID;
   int offset;
   string afterImage; 
   //Unlike an update record, only need redo info, not undo info!
-  int undoNextLSN;
+  LSN undoNextLSN;
 };
 
 ///////////////////  End CompenstationLogRecord  ///////////////////
@@ -104,23 +203,65 @@ class CompensationLogRecord : public LogRecord{
 /////////////////// ChkptLogRecord  ///////////////////
 class ChkptLogRecord : public LogRecord{
  public:
-  ChkptLogRecord(int lsn_in, int prev_lsn, int tx_id, 
+  ChkptLogRecord(LSN lsn_in, LSN prev_lsn, int tx_id, 
 		      map <int,txTableEntry> tx_table, 
-		      map <int,int> dirty_page_table) :
+		      map <int,LSN> dirty_page_table) :
   LogRecord(lsn_in, prev_lsn, tx_id, END_CKPT), txTable(tx_table),
     dirtyPageTable(dirty_page_table)
     {}
 
   map <int,txTableEntry> getTxTable() {return txTable;}
-  map <int,int> getDirtyPageTable() {return dirtyPageTable;}
-  virtual string toString();
- private:
+  map <int,LSN> getDirtyPageTable() {return dirtyPageTable;}
+  virtual void appendTo(string& out);
+ protected:
+  ChkptLogRecord(LSN lsn_in, LSN prev_lsn, int tx_id, TxType type,
+		 map <int,txTableEntry> tx_table,
+		 map <int,LSN> dirty_page_table) :
+  LogRecord(lsn_in, prev_lsn, tx_id, type), txTable(tx_table),
+    dirtyPageTable(dirty_page_table)
+    {}
+
   map <int,txTableEntry> txTable;
-  map <int,int> dirtyPageTable;  
+  map <int,LSN> dirtyPageTable;  
 
-  string intMapToString(map <int, int> myMap);
+  string intMapToString(map <int, LSN> myMap);
   string txMapToString(map <int, txTableEntry> myMap);
 };
 
 
 ///////////////////  End ChkptLogRecord  ///////////////////
+
+///////////////////  DeltaChkptLogRecord  ///////////////////
+//An end checkpoint holding only what changed since the checkpoint at
+//baseLSN (a full one or another delta): the Tx table and dirty page
+//table entries that were added or changed, and the tx ids and pages
+//that left the tables. getTxTable and getDirtyPageTable return the
+//added or changed entries.
+class DeltaChkptLogRecord : public ChkptLogRecord{
+ public:
+  DeltaChkptLogRecord(LSN lsn_in, LSN prev_lsn, LSN base_lsn,
+		      map <int,txTableEntry> tx_changes,
+		      map <int,LSN> dpt_changes,
+		      vector <int> removed_txs,
+		      vector <int> removed_pages) :
+  ChkptLogRecord(lsn_in, prev_lsn, -1, DELTA_CKPT, tx_changes, dpt_changes),
+    baseLSN(base_lsn), removedTxs(removed_txs), removedPages(removed_pages)
+    {}
+
+  LSN getBaseLSN() {return baseLSN;}
+  vector <int> getRemovedTxs() {return removedTxs;}
+  vector <int> getRemovedPages() {return removedPages;}
+
+  //Turns the tables as of the base checkpoint into the tables as of
+  //this one.
+  void applyTo(map <int,txTableEntry>& tx_table, map <int,LSN>& dirty_page_table);
+
+  virtual void appendTo(string& out);
+ private:
+  LSN baseLSN;
+  vector <int> removedTxs;
+  vector <int> removedPages;
+
+  string intListToString(vector <int> myList);
+};
+///////////////////  End DeltaChkptLogRecord  ///////////////////
@@ -0,0 +1,39 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <map>
+#include <string>
+#include <sstream>
+
+using namespace std;
+
+///////////////////  Metrics  ///////////////////
+
+/*
+ * Named counters and gauges a component reports about itself.
+ * The harness prints them when a testcase says <metrics>.
+ */
+class Metrics {
+ public:
+  void set(string name, double value) {values[name] = value;}
+  void add(string name, double delta) {values[name] += delta;}
+  double get(string name) {
+    map<string, double>::iterator it = values.find(name);
+    return it == values.end() ? 0 : it->second;
+  }
+
+  //One "name value" pair per line, sorted by name.
+  string toString() {
+    stringstream ss;
+    for (map<string, double>::iterator it = values.begin(); it != values.end(); ++it)
+      ss << it->first << "\t" << it->second << "\n";
+    return ss.str();
+  }
+
+ private:
+  map<string, double> values;
+};
+
+///////////////////  End Metrics  ///////////////////
+
+#endif
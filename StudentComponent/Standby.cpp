@@ -0,0 +1,88 @@
+#include "Standby.h"
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+Standby::Standby(string db_filename, string testcase_num, LogSource* log_source, LogMgrOptions options,
+		 string output_dir)
+  : lm(new LogMgr()), source(log_source), applied_lsn(NULL_LSN) {
+  lm->setStorageEngine(&se);
+  lm->setOptions(options);
+  se.setOutputDir(output_dir);
+  se.start(db_filename, lm, testcase_num + "_standby");
+  //pages are redone as records arrive, not in a bounded recovery
+  se.permitPageWrites(INT_MAX);
+  updateLag();
+}
+
+Standby::~Standby() {
+  delete lm;
+  delete source;
+}
+
+size_t Standby::fetch() {
+  string bytes;
+  if (source)
+    bytes = source->read();
+  received += bytes;
+  updateLag();
+  return bytes.size();
+}
+
+void Standby::apply() {
+  if (!lm)
+    return;
+  size_t end = received.rfind('\n');
+  if (end == string::npos)
+    return;
+  string records = received.substr(0, end + 1);
+  received.erase(0, end + 1);
+
+  //keep our own copy of the log before changing any page for it; it
+  //is the primary's byte for byte, so the LSNs are our own too
+  se.updateLog(records);
+  vector<LogRecord*> log = LogRecord::stringToRecordVector(records);
+  if (!log.empty())
+    se.observeLog(log[0]->getLSN() + records.size());
+  for (unsigned i = 0; i < log.size(); ++i) {
+    applied_lsn = log[i]->getLSN();
+    lm->replayRecord(log[i]);
+  }
+  metrics.add("standby_bytes_applied", records.size());
+  updateLag();
+}
+
+void Standby::catchUp() {
+  fetch();
+  apply();
+}
+
+LogMgr* Standby::promote() {
+  catchUp();
+  LogMgr* primary = lm;
+  primary->promote();
+  se.end_crash(primary);
+  lm = NULL;
+  delete source;
+  source = NULL;
+  return primary;
+}
+
+//private
+
+/*
+ * Lag in bytes is everything received but not applied; lag in LSNs
+ * runs to the last complete record received.
+ */
+void Standby::updateLag() {
+  LSN received_lsn = applied_lsn;
+  size_t end = received.rfind('\n');
+  if (end != string::npos) {
+    size_t start = end == 0 ? string::npos : received.rfind('\n', end - 1);
+    start = (start == string::npos) ? 0 : start + 1;
+    received_lsn = strtoll(received.c_str() + start, NULL, 10);
+  }
+  metrics.set("standby_applied_lsn", applied_lsn);
+  metrics.set("standby_lag_bytes", received.size());
+  metrics.set("standby_lag_lsns", received_lsn - applied_lsn);
+}
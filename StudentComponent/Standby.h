@@ -0,0 +1,86 @@
+#ifndef STANDBY_H_
+#define STANDBY_H_
+
+#include "LogMgr.h"
+#include "Metrics.h"
+#include "../StorageEngine/StorageEngine.h"
+#include "../StorageEngine/LogShipping.h"
+#include <string>
+
+using namespace std;
+
+///////////////////  Standby  ///////////////////
+
+/*
+ * A hot standby: a second StorageEngine and LogMgr that follow a
+ * primary's log as it becomes durable and keep their pages current by
+ * redoing it record by record. Failing over is then promote(), which
+ * only has to finish the tail and undo the transactions in flight,
+ * instead of a crash and a full recovery.
+ *
+ * The standby starts from the same database file as the primary and
+ * reads the primary's log from its first byte. Every record it applies
+ * is also appended to its own log, so after promotion it can recover
+ * from its own crashes.
+ */
+class Standby {
+ public:
+  /*
+   * Opens the standby's engine on db_filename (its output files are
+   * named after testcase_num, under output_dir) and reads the log from
+   * source, which it takes ownership of.
+   */
+  Standby(string db_filename, string testcase_num, LogSource* source, LogMgrOptions options,
+	  string output_dir = "output");
+  ~Standby();
+
+  /*
+   * Takes whatever log has arrived without applying it, and updates
+   * the lag metrics. Returns the number of bytes taken.
+   */
+  size_t fetch();
+
+  /*
+   * Applies every complete record fetched so far.
+   */
+  void apply();
+
+  /*
+   * fetch() and apply(): brings the standby up to what the primary
+   * has made durable.
+   */
+  void catchUp();
+
+  /*
+   * Catches up, then makes the standby a primary. Returns its LogMgr,
+   * which the caller owns from then on, and stops following the log.
+   */
+  LogMgr* promote();
+
+  StorageEngine* getStorageEngine() {return &se;}
+
+  /*
+   * standby_lag_bytes and standby_lag_lsns: how far the applied log
+   * trails what has been received.
+   */
+  Metrics& getMetrics() {return metrics;}
+
+ private:
+  StorageEngine se;
+  LogMgr* lm;
+  LogSource* source;
+  /* log received but not applied yet; may end in a partial record */
+  string received;
+  /* LSN of the last record applied, NULL_LSN before the first */
+  LSN applied_lsn;
+  Metrics metrics;
+
+  void updateLag();
+
+  Standby(const Standby&);
+  Standby& operator=(const Standby&);
+};
+
+///////////////////  End Standby  ///////////////////
+
+#endif
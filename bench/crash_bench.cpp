@@ -0,0 +1,110 @@
+//
+//  crash_bench.cpp
+//  Crash-point benchmark: runs a workload that leaves losers and
+//  unflushed committed work behind, then crashes it over and over with
+//  the same page write budget (as <crash {k k k ...}> would) until
+//  recovery gets to finish. Reports, per budget, how many crashes that
+//  took and how much log recovery parsed, with and without
+//  restartable_recovery.
+//
+//  usage: crash_bench.o [transactions] [writes per transaction]
+//  Works in a scratch directory under /tmp.
+//
+
+#include "../StorageEngine/StorageEngine.h"
+#include "../StudentComponent/LogMgr.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static const int PAGES = 40;
+static const int MAX_CRASHES = 1000;
+
+struct Result {
+  int crashes;
+  double records;
+  double ms;
+};
+
+static Result run(int run_no, int txs, int writes, int budget, bool restartable) {
+  LogMgrOptions options;
+  options.restartable_recovery = restartable;
+  //progress has to be saved well before the budget runs out
+  options.recovery_checkpoint_pages = max(1, budget / 2);
+
+  StorageEngine se;
+  LogMgr* lm = new LogMgr();
+  lm->setStorageEngine(&se);
+  lm->setOptions(options);
+  se.start("bench.db", lm, to_string(run_no));
+
+  //every other transaction commits; the rest are losers
+  for (int tx = 1; tx <= txs; ++tx) {
+    for (int w = 0; w < writes; ++w)
+      se.write(tx, 1 + (tx * 7 + w) % PAGES, (w * 3) % 40, "abc");
+    if (tx % 2 == 0)
+      lm->commit(tx);
+  }
+
+  Result result = {0, 0, 0};
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  bool done = false;
+  while (!done && result.crashes < MAX_CRASHES) {
+    LogMgr* next = new LogMgr();
+    next->setStorageEngine(&se);
+    next->setOptions(options);
+    se.crash(budget, next);
+    delete lm;
+    lm = next;
+    ++result.crashes;
+    result.records += lm->getMetrics().get("recovery_log_records");
+    done = lm->getMetrics().get("recovery_done") != 0;
+  }
+  result.ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  se.end_crash(lm);
+  if (!done)
+    result.crashes = -1;
+  delete lm;
+  return result;
+}
+
+int main(int argc, char* argv[]) {
+  int txs = argc > 1 ? atoi(argv[1]) : 40;
+  int writes = argc > 2 ? atoi(argv[2]) : 10;
+
+  char dir[] = "/tmp/crash_bench_XXXXXX";
+  if (!mkdtemp(dir) || chdir(dir) != 0)
+    return 1;
+  mkdir("output", 0755);
+  mkdir("output/log", 0755);
+  mkdir("output/dbs", 0755);
+  ofstream db("bench.db");
+  for (int p = 0; p < PAGES; ++p)
+    db << "-1 " << string(50, 'x') << "\n";
+  db.close();
+
+  cout << txs << " transactions x " << writes << " writes, " << PAGES << " pages" << endl;
+  cout << "budget\tmode\t\tcrashes\trecords parsed\tms" << endl;
+  int run_no = 0;
+  int budgets[] = {2, 8, 32, 128, 1024};
+  for (int budget : budgets) {
+    for (int restartable = 0; restartable < 2; ++restartable) {
+      Result r = run(++run_no, txs, writes, budget, restartable);
+      cout << budget << "\t" << (restartable ? "restartable" : "from scratch") << "\t";
+      if (r.crashes < 0)
+	cout << ">" << MAX_CRASHES;
+      else
+	cout << r.crashes;
+      cout << "\t" << r.records << "\t\t" << r.ms << endl;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,89 @@
+//
+//  device_bench.cpp
+//  The same workload and the same recovery code on every engine
+//  StorageEngine.h instantiates: transactions write small updates over
+//  more pages than the buffer pool holds, every other one commits, and
+//  the engine is crashed and recovered. Reports the cost of a write
+//  (including evictions to the page device), of the commits (log
+//  forces) and of recovery, per log and page device.
+//
+//  usage: device_bench.o [transactions] [writes per transaction]
+//  Works in a scratch directory under /tmp.
+//
+
+#include "../StorageEngine/StorageEngine.h"
+#include "../StudentComponent/LogMgr.h"
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static const int PAGES = 64;
+static const int PAGE_BYTES = 200;
+
+static double msSince(chrono::steady_clock::time_point start) {
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+template <class Engine>
+static void run(const char* name, int run_no, int txs, int writes) {
+  typedef typename Engine::LogMgrType EngineLogMgr;
+  Engine se;
+  EngineLogMgr* lm = new EngineLogMgr();
+  lm->setStorageEngine(&se);
+  se.start("bench.db", lm, to_string(run_no));
+
+  string input(16, 'a');
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (int tx = 1; tx <= txs; ++tx)
+    for (int w = 0; w < writes; ++w)
+      se.write(tx, 1 + (tx * 7 + w * 13) % PAGES, (w * 11) % (PAGE_BYTES - 16), input);
+  double write_ms = msSince(start);
+
+  start = chrono::steady_clock::now();
+  for (int tx = 2; tx <= txs; tx += 2)
+    lm->commit(tx);
+  double commit_ms = msSince(start);
+
+  EngineLogMgr* next = new EngineLogMgr();
+  next->setStorageEngine(&se);
+  start = chrono::steady_clock::now();
+  se.crash(INT_MAX, next);
+  double recover_ms = msSince(start);
+  se.end_crash(next);
+
+  cout << name << "\t" << write_ms * 1000 / (txs * writes) << "\t\t" << commit_ms * 1000 / (txs / 2)
+       << "\t\t" << recover_ms << "\t\t" << se.getLog().size() << endl;
+  delete lm;
+  delete next;
+}
+
+int main(int argc, char* argv[]) {
+  int txs = argc > 1 ? atoi(argv[1]) : 200;
+  int writes = argc > 2 ? atoi(argv[2]) : 10;
+
+  char dir[] = "/tmp/device_bench_XXXXXX";
+  if (!mkdtemp(dir) || chdir(dir) != 0)
+    return 1;
+  mkdir("output", 0755);
+  mkdir("output/log", 0755);
+  mkdir("output/dbs", 0755);
+  ofstream db("bench.db");
+  for (int p = 0; p < PAGES; ++p)
+    db << "-1 " << string(PAGE_BYTES, 'x') << "\n";
+  db.close();
+
+  cout << txs << " transactions x " << writes << " writes, " << PAGES << " pages" << endl;
+  cout << "log/pages\twrite us\tcommit us\trecovery ms\tlog bytes" << endl;
+  run<MemoryStorageEngine>("memory/memory", 1, txs, writes);
+  run<StorageEngine>("file/memory", 2, txs, writes);
+  run<FileStorageEngine>("file/file", 3, txs, writes);
+  run<DirectStorageEngine>("direct/direct", 4, txs, writes);
+  return 0;
+}
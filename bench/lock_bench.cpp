@@ -0,0 +1,118 @@
+//
+//  lock_bench.cpp
+//  Lock manager under contention: several threads run transactions
+//  that each read a few ranges of a small set of hot pages under shared
+//  locks and then write them, so upgrades collide and deadlock. A
+//  transaction whose write comes back false was aborted as a victim
+//  (or timed out) and is not retried. Reports throughput, deadlocks
+//  per 1000 transactions and lock wait times, page locks against
+//  range locks.
+//
+//  usage: lock_bench.o [threads] [transactions per thread] [hot pages]
+//  Works in a scratch directory under /tmp.
+//
+
+#include "../StorageEngine/StorageEngine.h"
+#include "../StudentComponent/LockMgr.h"
+#include "../StudentComponent/LogMgr.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static const int WRITES_PER_TX = 4;
+static const int PAGE_BYTES = 64;
+static const int RANGE = 8;
+
+struct Result {
+  double ms;
+  int committed;
+  int aborted;
+  Metrics locks;
+};
+
+static Result run(int run_no, int threads, int txs, int hot_pages, bool ranges) {
+  StorageEngine se;
+  LogMgr* lm = new LogMgr();
+  lm->setStorageEngine(&se);
+  se.start("bench.db", lm, to_string(run_no));
+  se.setLocking(true);
+  se.getLockMgr()->setRangeLocks(ranges);
+  se.getLockMgr()->setTimeoutMs(200);
+
+  atomic<int> next_tx(1), committed(0), aborted(0);
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  vector<thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.push_back(thread([&, t]() {
+      mt19937 rng(t + 1);
+      for (int i = 0; i < txs; ++i) {
+	int txid = next_tx++;
+	bool ok = true;
+	for (int w = 0; ok && w < WRITES_PER_TX; ++w) {
+	  int page = 1 + rng() % hot_pages;
+	  int offset = (rng() % (PAGE_BYTES / RANGE)) * RANGE;
+	  ok = se.getLockMgr()->lock(txid, page, offset, RANGE, SHARED) &&
+	    se.write(txid, page, offset, string(RANGE, 'a' + txid % 26));
+	}
+	if (ok) {
+	  lm->commit(txid);
+	  committed++;
+	}
+	else {
+	  aborted++;
+	}
+      }
+    }));
+  }
+  for (unsigned t = 0; t < workers.size(); ++t)
+    workers[t].join();
+
+  Result result;
+  result.ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  result.committed = committed;
+  result.aborted = aborted;
+  result.locks = se.getLockMgr()->getMetrics();
+  delete lm;
+  return result;
+}
+
+int main(int argc, char* argv[]) {
+  int threads = argc > 1 ? atoi(argv[1]) : 4;
+  int txs = argc > 2 ? atoi(argv[2]) : 200;
+  int hot_pages = argc > 3 ? atoi(argv[3]) : 4;
+
+  char dir[] = "/tmp/lock_bench_XXXXXX";
+  if (!mkdtemp(dir) || chdir(dir) != 0)
+    return 1;
+  mkdir("output", 0755);
+  mkdir("output/log", 0755);
+  mkdir("output/dbs", 0755);
+  ofstream db("bench.db");
+  for (int p = 0; p < hot_pages; ++p)
+    db << "-1 " << string(PAGE_BYTES, 'x') << "\n";
+  db.close();
+
+  cout << threads << " threads x " << txs << " transactions x " << WRITES_PER_TX
+       << " writes, " << hot_pages << " hot pages" << endl;
+  cout << "locks\ttx/s\taborted\tdeadlocks/1000tx\twait avg us\twait max us" << endl;
+  for (int ranges = 0; ranges < 2; ++ranges) {
+    Result r = run(ranges + 1, threads, txs, hot_pages, ranges);
+    int total = threads * txs;
+    double waits = r.locks.get("lock_waits");
+    cout << (ranges ? "range" : "page") << "\t" << (int)(r.committed * 1000 / r.ms)
+	 << "\t" << r.aborted << "\t" << r.locks.get("deadlocks") * 1000 / total << "\t\t\t"
+	 << (waits ? r.locks.get("lock_wait_us_total") / waits : 0) << "\t\t"
+	 << r.locks.get("lock_wait_us_max") << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,74 @@
+//
+//  parse_bench.cpp
+//  Log parse throughput: builds a synthetic log of the record mix the
+//  harness produces and times LogRecord::stringToRecordVector on it
+//  with 1, 2, 4 and hardware_concurrency threads.
+//
+//  usage: parse_bench.o [megabytes]
+//
+
+#include "../StudentComponent/LogRecord.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static string makeLog(size_t bytes) {
+  string log;
+  int lsn = 1;
+  while (log.size() < bytes) {
+    int tx = lsn % 17;
+    switch (lsn % 8) {
+    case 0:
+      log += CompensationLogRecord(lsn, lsn - 1, tx, lsn % 131, 7, "xxxxxxxx", lsn - 5).toString();
+      break;
+    case 1:
+      log += LogRecord(lsn, lsn - 1, tx, COMMIT).toString();
+      break;
+    case 2: {
+      map<int, txTableEntry> txs;
+      map<int, LSN> dpt;
+      for (int i = 0; i < 8; ++i) {
+	txs[i] = txTableEntry(lsn - i, U);
+	dpt[i * 3] = lsn - 2 * i;
+      }
+      log += ChkptLogRecord(lsn, lsn - 1, -1, txs, dpt).toString();
+      break;
+    }
+    default:
+      log += UpdateLogRecord(lsn, lsn - 1, tx, lsn % 131, lsn % 40, "xxxxxxxxx", "abcdefghi").toString();
+    }
+    ++lsn;
+  }
+  return log;
+}
+
+int main(int argc, char* argv[]) {
+  size_t mb = argc > 1 ? atoi(argv[1]) : 64;
+  string log = makeLog(mb << 20);
+  cout << "log size: " << log.size() / (1 << 20) << " MB" << endl;
+
+  vector<unsigned> thread_counts = {1, 2, 4};
+  unsigned hw = thread::hardware_concurrency();
+  if (hw > 4)
+    thread_counts.push_back(hw);
+
+  for (unsigned threads : thread_counts) {
+    double best = 0;
+    size_t records = 0;
+    for (int rep = 0; rep < 3; ++rep) {
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      vector<LogRecord*> parsed = LogRecord::stringToRecordVector(log, threads);
+      double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+      best = max(best, log.size() / secs / (1 << 20));
+      records = parsed.size();
+      for (LogRecord* r : parsed)
+	delete r;
+    }
+    cout << threads << " thread(s): " << records << " records, " << best << " MB/s" << endl;
+  }
+  return 0;
+}
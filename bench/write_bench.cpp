@@ -0,0 +1,119 @@
+//
+//  write_bench.cpp
+//  Heap allocations on the write path: replaces the global operator
+//  new with one that counts, then reports allocations and bytes per
+//  StorageEngine::write, per record undone by an abort and per record
+//  redone after a crash. Every write hits a page already in the buffer
+//  and images are longer than the small-string buffer, so what is
+//  counted is the copying of the images themselves.
+//
+//  usage: write_bench.o [writes] [image bytes]
+//  Works in a scratch directory under /tmp.
+//
+
+#include "../StorageEngine/StorageEngine.h"
+#include "../StudentComponent/LogMgr.h"
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static atomic<long long> allocations(0);
+static atomic<long long> allocated_bytes(0);
+
+void* operator new(size_t size) {
+  allocations++;
+  allocated_bytes += size;
+  void* p = malloc(size ? size : 1);
+  if (!p)
+    throw bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+static const int PAGES = 8;
+static const int PAGE_BYTES = 200;
+
+struct Count {
+  long long allocations;
+  long long bytes;
+};
+
+static Count now() {
+  Count c = {allocations.load(), allocated_bytes.load()};
+  return c;
+}
+
+static void report(const char* what, Count start, long long ops) {
+  Count end = now();
+  cout << what << "\t" << (double)(end.allocations - start.allocations) / ops
+       << "\t\t" << (double)(end.bytes - start.bytes) / ops << endl;
+}
+
+int main(int argc, char* argv[]) {
+  int writes = argc > 1 ? atoi(argv[1]) : 100000;
+  int image = argc > 2 ? atoi(argv[2]) : 32;
+
+  char dir[] = "/tmp/write_bench_XXXXXX";
+  if (!mkdtemp(dir) || chdir(dir) != 0)
+    return 1;
+  mkdir("output", 0755);
+  mkdir("output/log", 0755);
+  mkdir("output/dbs", 0755);
+  ofstream db("bench.db");
+  for (int p = 0; p < PAGES; ++p)
+    db << "-1 " << string(PAGE_BYTES, 'x') << "\n";
+  db.close();
+
+  StorageEngine se;
+  LogMgr* lm = new LogMgr();
+  lm->setStorageEngine(&se);
+  se.start("bench.db", lm, "1");
+
+  string input(image, 'a');
+  //load every page first so the writes only measure the write path
+  for (int p = 1; p <= PAGES; ++p)
+    se.write(1, p, 0, input);
+
+  cout << writes << " writes of " << image << " bytes, " << PAGES << " pages" << endl;
+  cout << "path\tallocs/op\tbytes/op" << endl;
+
+  //transaction 2 is aborted below, so its records stay in memory
+  //until the abort forces them; keep the tail bounded
+  Count start = now();
+  for (int w = 0; w < writes; ++w) {
+    input[w % image] = 'a' + w % 26;
+    se.write(2, 1 + w % PAGES, (w * 7) % (PAGE_BYTES - image), input);
+  }
+  report("write", start, writes);
+
+  start = now();
+  se.abort(2, writes);
+  report("undo", start, writes);
+
+  for (int w = 0; w < writes; ++w)
+    se.write(3, 1 + w % PAGES, (w * 7) % (PAGE_BYTES - image), input);
+  lm->commit(3);
+  LogMgr* next = new LogMgr();
+  next->setStorageEngine(&se);
+  start = now();
+  se.crash(writes * 4, next);
+  report("recover", start, writes);
+  se.end_crash(next);
+  delete lm;
+  delete next;
+  return 0;
+}